@@ -0,0 +1,13 @@
+/**
+ * Generic extensions for default implementations that don't provide their own.
+ * Kept separate from energymon-ext.c, which may also be compiled into binaries.
+ *
+ * @date 2026-10-16
+ */
+#include "energymon.h"
+#include "energymon-default.h"
+#include "energymon-ext.h"
+
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_fallback(ext);
+}
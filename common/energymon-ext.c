@@ -0,0 +1,83 @@
+/**
+ * Internal utility functions for energymon extensions.
+ *
+ * @date 2026-10-16
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include "energymon.h"
+#include "energymon-ext.h"
+#include "energymon-time-util.h"
+
+int energymon_ext_clear(energymon_ext* ext) {
+  if (ext == NULL || ext->size < sizeof(ext->size)) {
+    errno = EINVAL;
+    return -1;
+  }
+  // don't write beyond what the caller allocated, or what we know about
+  size_t len = ext->size < sizeof(energymon_ext) ? ext->size : sizeof(energymon_ext);
+  memset((char*) ext + sizeof(ext->size), 0, len - sizeof(ext->size));
+  return 0;
+}
+
+size_t energymon_read_samples_fallback(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->fread == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  size_t i;
+  for (i = 0; i < n; i++) {
+    samples[i].time_ns = energymon_gettime_ns();
+    errno = 0;
+    samples[i].energy_uj = em->fread(em);
+    if (samples[i].energy_uj == 0 && errno) {
+      break;
+    }
+  }
+  return i;
+}
+
+size_t energymon_read_channels_fallback(const energymon* em, energymon_channel* channels, size_t n) {
+  if (em == NULL || em->fread == NULL || em->fsource == NULL || (channels == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  if (n == 0) {
+    return 1;
+  }
+  // the energymon is its own (only) channel
+  if (em->fsource(channels[0].name, sizeof(channels[0].name)) == NULL) {
+    return 0;
+  }
+  errno = 0;
+  channels[0].energy_uj = em->fread(em);
+  if (channels[0].energy_uj == 0 && errno) {
+    return 0;
+  }
+  return 1;
+}
+
+int energymon_get_ext_fallback(energymon_ext* ext) {
+  if (energymon_ext_clear(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_samples)) {
+    ext->fread_samples = &energymon_read_samples_fallback;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_channels)) {
+    ext->fread_channels = &energymon_read_channels_fallback;
+  }
+  return 0;
+}
+
+int energymon_get_ext_fallback_samples(energymon_ext* ext, energymon_read_samples fread_samples) {
+  if (energymon_get_ext_fallback(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_samples)) {
+    ext->fread_samples = fread_samples;
+  }
+  return 0;
+}
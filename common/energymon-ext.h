@@ -0,0 +1,59 @@
+/**
+ * Internal utility functions for energymon extensions.
+ */
+#ifndef _ENERGYMON_EXT_H_
+#define _ENERGYMON_EXT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "energymon.h"
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * Validate an energymon_ext struct and set all function pointers that fit
+ * within its size to NULL.
+ *
+ * @param ext
+ *  the extensions struct, must not be NULL (sets errno to EINVAL otherwise)
+ * @return 0 on success, -1 on failure
+ */
+int energymon_ext_clear(energymon_ext* ext);
+
+/**
+ * Generic implementation of energymon_read_samples.
+ * Loops over the energymon's fread function.
+ */
+size_t energymon_read_samples_fallback(const energymon* em, energymon_sample* samples, size_t n);
+
+/**
+ * Generic implementation of energymon_read_channels.
+ * Reports the energymon as a single channel, named by its fsource function.
+ */
+size_t energymon_read_channels_fallback(const energymon* em, energymon_channel* channels, size_t n);
+
+/**
+ * Populate an energymon_ext struct with generic implementations.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int energymon_get_ext_fallback(energymon_ext* ext);
+
+/**
+ * Populate an energymon_ext struct with generic implementations, except for
+ * the given fread_samples implementation.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int energymon_get_ext_fallback_samples(energymon_ext* ext, energymon_read_samples fread_samples);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
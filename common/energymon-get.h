@@ -17,6 +17,8 @@ extern "C" {
 
 int energymon_get(energymon* em);
 
+int energymon_get_ext(energymon_ext* ext);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
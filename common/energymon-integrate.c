@@ -0,0 +1,65 @@
+/**
+ * Integrate power samples into energy.
+ *
+ * @date 2026-10-16
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include "energymon-integrate.h"
+
+int energymon_integration_parse(const char* name, energymon_integration* rule) {
+  if (name == NULL || !strcmp(name, "rectangle")) {
+    *rule = ENERGYMON_INTEGRATION_RECTANGLE;
+  } else if (!strcmp(name, "trapezoid")) {
+    *rule = ENERGYMON_INTEGRATION_TRAPEZOID;
+  } else if (!strcmp(name, "window")) {
+    *rule = ENERGYMON_INTEGRATION_WINDOW;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void energymon_integrator_init(energymon_integrator* integ, energymon_integration rule, uint64_t window_us) {
+  integ->rule = rule;
+  integ->window_us = window_us;
+  integ->last_uw = 0;
+  integ->has_last = 0;
+  integ->remainder_uj = 0;
+}
+
+uint64_t energymon_integrator_add(energymon_integrator* integ, double power_uw, uint64_t dt_us) {
+  // without a previous sample, all rules degrade to the rectangle rule
+  double last_uw = integ->has_last ? integ->last_uw : power_uw;
+  double uj;
+  uint64_t ret;
+  switch (integ->rule) {
+    case ENERGYMON_INTEGRATION_TRAPEZOID:
+      uj = (last_uw + power_uw) / 2 * (double) dt_us;
+      break;
+    case ENERGYMON_INTEGRATION_WINDOW:
+      if (integ->window_us >= dt_us) {
+        // the sensor's average covers the whole interval
+        uj = power_uw * (double) dt_us;
+      } else {
+        // the sensor only observed the end of the interval
+        uj = power_uw * (double) integ->window_us +
+             (last_uw + power_uw) / 2 * (double) (dt_us - integ->window_us);
+      }
+      break;
+    case ENERGYMON_INTEGRATION_RECTANGLE:
+    default:
+      uj = power_uw * (double) dt_us;
+      break;
+  }
+  // uW * us = pJ
+  uj = uj / 1000000 + integ->remainder_uj;
+  ret = (uint64_t) uj;
+  integ->remainder_uj = uj - (double) ret;
+  integ->last_uw = power_uw;
+  integ->has_last = 1;
+  return ret;
+}
@@ -0,0 +1,80 @@
+/**
+ * Internal utility for integrating power samples into energy.
+ */
+#ifndef _ENERGYMON_INTEGRATE_H_
+#define _ENERGYMON_INTEGRATE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * Integration rules, selected by name with energymon_integration_parse.
+ */
+typedef enum energymon_integration {
+  // "rectangle": each sample's power is used for the whole interval that ends with it
+  ENERGYMON_INTEGRATION_RECTANGLE = 0,
+  // "trapezoid": the average of the power at the start and end of the interval
+  ENERGYMON_INTEGRATION_TRAPEZOID,
+  // "window": each sample's power is the sensor's average over its averaging window, which ends with the sample;
+  // the rest of a longer interval is interpolated from the previous sample
+  ENERGYMON_INTEGRATION_WINDOW,
+} energymon_integration;
+
+typedef struct energymon_integrator {
+  energymon_integration rule;
+  // the sensor's averaging window in microseconds
+  uint64_t window_us;
+  // the previous power sample in microwatts
+  double last_uw;
+  int has_last;
+  // fractional microjoules not yet reported
+  double remainder_uj;
+} energymon_integrator;
+
+/**
+ * Parse an integration rule name: "rectangle", "trapezoid", or "window".
+ *
+ * @param name
+ *  the rule name, or NULL for the default (rectangle)
+ * @param rule
+ *  must not be NULL
+ * @return 0 on success, -1 on failure (errno is set to EINVAL)
+ */
+int energymon_integration_parse(const char* name, energymon_integration* rule);
+
+/**
+ * Initialize an integrator.
+ *
+ * @param integ
+ *  must not be NULL
+ * @param rule
+ * @param window_us
+ *  the sensor's averaging window in microseconds (for ENERGYMON_INTEGRATION_WINDOW)
+ */
+void energymon_integrator_init(energymon_integrator* integ, energymon_integration rule, uint64_t window_us);
+
+/**
+ * Add a power sample.
+ *
+ * @param integ
+ *  must not be NULL
+ * @param power_uw
+ *  the power in microwatts
+ * @param dt_us
+ *  the time since the previous sample (or the start) in microseconds
+ * @return the energy over the interval in microjoules
+ */
+uint64_t energymon_integrator_add(energymon_integrator* integ, double power_uw, uint64_t dt_us);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * A single polling thread that is shared by energymon instances.
+ *
+ * @date 2026-10-16
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include "energymon-poller.h"
+#include "energymon-time-util.h"
+
+// relative power change between samples above which the signal isn't flat
+#ifndef ENERGYMON_POLLER_ADAPTIVE_THRESHOLD
+  #define ENERGYMON_POLLER_ADAPTIVE_THRESHOLD 0.05
+#endif
+
+// serializes starting and stopping the thread
+static pthread_mutex_t poller_lifecycle_lock = PTHREAD_MUTEX_INITIALIZER;
+// protects the task list - released by the thread while calling sample functions
+static pthread_mutex_t poller_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t poller_once = PTHREAD_ONCE_INIT;
+// wakes the thread early for (un)registrations
+static pthread_cond_t poller_cond;
+static int poller_cond_err;
+// signaled when a sample function returns
+static pthread_cond_t poller_done_cond = PTHREAD_COND_INITIALIZER;
+static energymon_poller_task* poller_tasks = NULL;
+static pthread_t poller_thread;
+static int poller_started = 0;
+static int poller_stop = 0;
+
+static void poller_init_cond(void) {
+  pthread_condattr_t attr;
+  if ((poller_cond_err = pthread_condattr_init(&attr))) {
+    return;
+  }
+  // deadlines must not jump with the system time
+  if (!(poller_cond_err = pthread_condattr_setclock(&attr, ENERGYMON_CLOCK_MONOTONIC))) {
+    poller_cond_err = pthread_cond_init(&poller_cond, &attr);
+  }
+  pthread_condattr_destroy(&attr);
+}
+
+static void* poller_run(void* arg) {
+  energymon_poller_task* task;
+  struct timespec ts;
+  uint64_t now_ns;
+  uint64_t next_ns;
+  (void) arg;
+  pthread_mutex_lock(&poller_lock);
+  while (!poller_stop) {
+    now_ns = energymon_gettime_ns();
+    next_ns = UINT64_MAX;
+    for (task = poller_tasks; task != NULL; task = task->next) {
+      // skip any deadlines that were missed - there's no value in calling fn more than once now
+      if (energymon_periodic_advance(&task->period, now_ns) > 0) {
+        // don't let a slow sample function block other tasks from (un)registering
+        task->running = 1;
+        pthread_mutex_unlock(&poller_lock);
+        task->fn(task->arg);
+        pthread_mutex_lock(&poller_lock);
+        task->running = 0;
+        pthread_cond_broadcast(&poller_done_cond);
+        // the list may have changed, and time has passed, so start over
+        break;
+      }
+      if (task->period.deadline_ns < next_ns) {
+        next_ns = task->period.deadline_ns;
+      }
+    }
+    if (task != NULL) {
+      continue;
+    }
+    if (next_ns == UINT64_MAX) {
+      pthread_cond_wait(&poller_cond, &poller_lock);
+    } else if (next_ns > energymon_gettime_ns()) {
+      // (un)registrations wake the thread early
+      ts.tv_sec = (time_t) (next_ns / 1000000000);
+      ts.tv_nsec = (long) (next_ns % 1000000000);
+      pthread_cond_timedwait(&poller_cond, &poller_lock, &ts);
+    }
+  }
+  pthread_mutex_unlock(&poller_lock);
+  return NULL;
+}
+
+int energymon_poller_register(energymon_poller_task* task, uint64_t interval_us,
+                              energymon_poller_fn fn, void* arg) {
+  uint64_t now_ns;
+  int err = 0;
+  if (task == NULL || fn == NULL || interval_us == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((err = pthread_once(&poller_once, poller_init_cond)) || (err = poller_cond_err)) {
+    errno = err;
+    return -1;
+  }
+  if (energymon_periodic_init(&task->period, interval_us)) {
+    return -1;
+  }
+  task->fn = fn;
+  task->arg = arg;
+  task->running = 0;
+  // align to a multiple of the interval, rather than one interval from now
+  now_ns = task->period.deadline_ns - task->period.interval_ns;
+  task->period.deadline_ns = (now_ns / task->period.interval_ns + 1) * task->period.interval_ns;
+  pthread_mutex_lock(&poller_lifecycle_lock);
+  pthread_mutex_lock(&poller_lock);
+  task->next = poller_tasks;
+  poller_tasks = task;
+  if (!poller_started) {
+    poller_stop = 0;
+    if ((err = pthread_create(&poller_thread, NULL, poller_run, NULL))) {
+      poller_tasks = task->next;
+    } else {
+      poller_started = 1;
+    }
+  } else {
+    pthread_cond_signal(&poller_cond);
+  }
+  pthread_mutex_unlock(&poller_lock);
+  pthread_mutex_unlock(&poller_lifecycle_lock);
+  errno = err;
+  return err ? -1 : 0;
+}
+
+int energymon_poller_unregister(energymon_poller_task* task) {
+  energymon_poller_task** t;
+  int join = 0;
+  int err = 0;
+  if (task == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&poller_lifecycle_lock);
+  pthread_mutex_lock(&poller_lock);
+  for (t = &poller_tasks; *t != NULL && *t != task; t = &(*t)->next);
+  if (*t == NULL) {
+    err = EINVAL;
+  } else {
+    *t = task->next;
+    task->next = NULL;
+    // the thread won't call it again now that it's unlinked, but it may be running now
+    while (task->running) {
+      pthread_cond_wait(&poller_done_cond, &poller_lock);
+    }
+    if (poller_tasks == NULL) {
+      poller_stop = 1;
+      join = 1;
+    }
+    pthread_cond_signal(&poller_cond);
+  }
+  pthread_mutex_unlock(&poller_lock);
+  if (join) {
+    err = pthread_join(poller_thread, NULL);
+    poller_started = 0;
+  }
+  pthread_mutex_unlock(&poller_lifecycle_lock);
+  errno = err;
+  return err ? -1 : 0;
+}
+
+void energymon_poller_set_interval(energymon_poller_task* task, uint64_t interval_us) {
+  // only the thread uses the period, and it applies the interval after the sample function returns
+  task->period.interval_ns = interval_us * 1000;
+}
+
+static int parse_interval_env(const char* name, uint64_t* us) {
+  const char* val;
+  char* end;
+  unsigned long long ull;
+  if (name == NULL || (val = getenv(name)) == NULL) {
+    return 0;
+  }
+  errno = 0;
+  ull = strtoull(val, &end, 0);
+  if (errno || end == val || *end != '\0' || ull == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  *us = (uint64_t) ull;
+  return 1;
+}
+
+int energymon_poller_adaptive_init(energymon_poller_adaptive* a, uint64_t interval_us,
+                                   const char* min_env, const char* max_env) {
+  int has_max;
+  if (a == NULL || interval_us == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  a->min_us = interval_us;
+  a->max_us = interval_us;
+  a->interval_us = interval_us;
+  a->last_uw = 0;
+  a->has_last = 0;
+  if ((has_max = parse_interval_env(max_env, &a->max_us)) < 0) {
+    return -1;
+  }
+  if (has_max && parse_interval_env(min_env, &a->min_us) < 0) {
+    return -1;
+  }
+  if (a->min_us > a->max_us) {
+    errno = EINVAL;
+    return -1;
+  }
+  a->interval_us = a->min_us;
+  return 0;
+}
+
+uint64_t energymon_poller_adaptive_next(energymon_poller_adaptive* a, double power_uw) {
+  double delta_uw;
+  if (a->min_us == a->max_us) {
+    return a->interval_us;
+  }
+  delta_uw = power_uw > a->last_uw ? power_uw - a->last_uw : a->last_uw - power_uw;
+  if (!a->has_last || delta_uw > a->last_uw * ENERGYMON_POLLER_ADAPTIVE_THRESHOLD) {
+    // capture the transition at full rate
+    a->interval_us = a->min_us;
+  } else if (a->interval_us < a->max_us) {
+    // flat - back off exponentially
+    a->interval_us = a->interval_us * 2 < a->max_us ? a->interval_us * 2 : a->max_us;
+  }
+  a->last_uw = power_uw;
+  a->has_last = 1;
+  return a->interval_us;
+}
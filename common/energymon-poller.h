@@ -0,0 +1,129 @@
+/**
+ * Internal utility for sharing a single polling thread between energymon
+ * instances in a process.
+ */
+#ifndef _ENERGYMON_POLLER_H_
+#define _ENERGYMON_POLLER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include "energymon-time-util.h"
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * A sample function, called periodically from the polling thread.
+ */
+typedef void (*energymon_poller_fn)(void* arg);
+
+/**
+ * A registered sample function - owned by the caller, but managed by the
+ * poller while registered.
+ */
+typedef struct energymon_poller_task {
+  energymon_poller_fn fn;
+  void* arg;
+  // the schedule for fn - missed deadlines are skipped, not counted as overruns
+  energymon_periodic period;
+  // whether fn is being called (without holding the poller's lock)
+  int running;
+  struct energymon_poller_task* next;
+} energymon_poller_task;
+
+/**
+ * Register a sample function to be called at the given interval.
+ * The polling thread is started by the first registration.
+ * Deadlines are aligned to multiples of the interval, so tasks with the same
+ * (or harmonic) intervals are sampled together in the same wakeup.
+ * The first call is at the first aligned deadline after registration.
+ *
+ * @param task
+ *  must not be NULL or already registered
+ * @param interval_us
+ *  the polling interval in microseconds, must be > 0
+ * @param fn
+ *  the sample function, which should not block for long since it delays other
+ *  tasks (but doesn't block registration or unregistration of other tasks)
+ * @param arg
+ *  the argument to fn
+ * @return 0 on success, -1 on failure
+ */
+int energymon_poller_register(energymon_poller_task* task, uint64_t interval_us,
+                              energymon_poller_fn fn, void* arg);
+
+/**
+ * Unregister a sample function.
+ * When this function returns, the sample function is not running and won't be
+ * called again (waits for a call in progress to finish).
+ * The polling thread is stopped by the last unregistration.
+ * Must not be called from a sample function.
+ *
+ * @param task
+ *  must not be NULL
+ * @return 0 on success, -1 on failure
+ */
+int energymon_poller_unregister(energymon_poller_task* task);
+
+/**
+ * Change a task's polling interval, starting after the current deadline.
+ * Must only be called from the task's sample function.
+ *
+ * @param task
+ *  must not be NULL
+ * @param interval_us
+ *  the polling interval in microseconds, must be > 0
+ */
+void energymon_poller_set_interval(energymon_poller_task* task, uint64_t interval_us);
+
+/**
+ * An adaptive polling policy: poll at the minimum interval while the power is
+ * changing, and back off toward the maximum interval while it's flat.
+ */
+typedef struct energymon_poller_adaptive {
+  uint64_t min_us;
+  uint64_t max_us;
+  uint64_t interval_us;
+  // the previous power sample in microwatts
+  double last_uw;
+  int has_last;
+} energymon_poller_adaptive;
+
+/**
+ * Initialize an adaptive polling policy from environment variables.
+ * Adaptation is enabled only if the max_env variable is set, otherwise the
+ * interval remains fixed at interval_us.
+ *
+ * @param a
+ *  must not be NULL
+ * @param interval_us
+ *  the default (and fastest) polling interval, must be > 0
+ * @param min_env
+ *  the name of an environment variable that overrides the minimum interval
+ * @param max_env
+ *  the name of an environment variable that sets the maximum interval
+ * @return 0 on success, -1 on failure (errno is set to EINVAL for bad values)
+ */
+int energymon_poller_adaptive_init(energymon_poller_adaptive* a, uint64_t interval_us,
+                                   const char* min_env, const char* max_env);
+
+/**
+ * Update the policy with a new power sample and get the next polling interval.
+ *
+ * @param a
+ *  must not be NULL
+ * @param power_uw
+ *  the power in microwatts
+ * @return the next polling interval in microseconds
+ */
+uint64_t energymon_poller_adaptive_next(energymon_poller_adaptive* a, double power_uw);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
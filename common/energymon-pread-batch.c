@@ -0,0 +1,217 @@
+/**
+ * Batched pread operations, using io_uring when available.
+ *
+ * @date 2026-10-16
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "energymon-pread-batch.h"
+
+// avoid a liburing dependency - the raw interface is sufficient for fixed reads
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ENERGYMON_USE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef ENERGYMON_USE_IO_URING
+
+static void ring_destroy(energymon_pread_batch* batch) {
+  if (batch->sqes != NULL && batch->sqes != MAP_FAILED) {
+    munmap(batch->sqes, batch->sqes_len);
+  }
+  if (batch->cq_ptr != NULL && batch->cq_ptr != MAP_FAILED) {
+    munmap(batch->cq_ptr, batch->cq_len);
+  }
+  if (batch->sq_ptr != NULL && batch->sq_ptr != MAP_FAILED) {
+    munmap(batch->sq_ptr, batch->sq_len);
+  }
+  if (batch->ring_fd >= 0) {
+    close(batch->ring_fd);
+  }
+  free(batch->iovs);
+  batch->sqes = NULL;
+  batch->cq_ptr = NULL;
+  batch->sq_ptr = NULL;
+  batch->iovs = NULL;
+  batch->ring_fd = -1;
+}
+
+static int ring_init(energymon_pread_batch* batch) {
+  struct io_uring_params p;
+  struct io_uring_sqe* sqes;
+  struct iovec* iovs;
+  char* sq;
+  char* cq;
+  size_t i;
+  memset(&p, 0, sizeof(p));
+  if ((batch->ring_fd = (int) syscall(__NR_io_uring_setup, (unsigned int) batch->n, &p)) < 0) {
+    batch->ring_fd = -1;
+    return -1;
+  }
+  batch->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  batch->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  batch->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  batch->sq_ptr = mmap(NULL, batch->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       batch->ring_fd, IORING_OFF_SQ_RING);
+  batch->cq_ptr = mmap(NULL, batch->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       batch->ring_fd, IORING_OFF_CQ_RING);
+  batch->sqes = mmap(NULL, batch->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     batch->ring_fd, IORING_OFF_SQES);
+  batch->iovs = malloc(batch->n * sizeof(struct iovec));
+  if (batch->sq_ptr == MAP_FAILED || batch->cq_ptr == MAP_FAILED || batch->sqes == MAP_FAILED ||
+      batch->iovs == NULL) {
+    ring_destroy(batch);
+    return -1;
+  }
+  sq = batch->sq_ptr;
+  cq = batch->cq_ptr;
+  batch->sq_tail = (unsigned int*) (sq + p.sq_off.tail);
+  batch->sq_mask = (unsigned int*) (sq + p.sq_off.ring_mask);
+  batch->sq_array = (unsigned int*) (sq + p.sq_off.array);
+  batch->cq_head = (unsigned int*) (cq + p.cq_off.head);
+  batch->cq_tail = (unsigned int*) (cq + p.cq_off.tail);
+  batch->cq_mask = (unsigned int*) (cq + p.cq_off.ring_mask);
+  batch->cqes = cq + p.cq_off.cqes;
+  // the operations never change, so prepare the submission entries only once
+  sqes = batch->sqes;
+  iovs = batch->iovs;
+  for (i = 0; i < batch->n; i++) {
+    iovs[i].iov_base = batch->ops[i].buf;
+    iovs[i].iov_len = batch->ops[i].len;
+    memset(&sqes[i], 0, sizeof(sqes[i]));
+    sqes[i].opcode = IORING_OP_READV;
+    sqes[i].fd = batch->ops[i].fd;
+    sqes[i].addr = (uint64_t) (uintptr_t) &iovs[i];
+    sqes[i].len = 1;
+    sqes[i].off = 0;
+    sqes[i].user_data = i;
+  }
+  return 0;
+}
+
+/**
+ * Returns 0 on success, -1 on io_uring failure (not if reads fail).
+ */
+static int ring_read(energymon_pread_batch* batch, size_t n) {
+  const struct io_uring_cqe* cqes = batch->cqes;
+  const struct io_uring_cqe* cqe;
+  unsigned int sq_tail = *batch->sq_tail;
+  unsigned int cq_head = *batch->cq_head;
+  unsigned int cq_tail;
+  size_t reaped = 0;
+  size_t i;
+  long ret;
+  for (i = 0; i < n; i++) {
+    batch->sq_array[(sq_tail + i) & *batch->sq_mask] = (unsigned int) i;
+  }
+  __atomic_store_n(batch->sq_tail, sq_tail + (unsigned int) n, __ATOMIC_RELEASE);
+  // submit and wait for all completions (if interrupted, nothing was submitted)
+  do {
+    ret = syscall(__NR_io_uring_enter, batch->ring_fd, (unsigned int) n, (unsigned int) n,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    return -1;
+  }
+  if ((size_t) ret != n) {
+    // submission stopped early, ring state is no longer predictable
+    errno = EIO;
+    return -1;
+  }
+  while (reaped < n) {
+    cq_tail = __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE);
+    for (; cq_head != cq_tail; cq_head++, reaped++) {
+      cqe = &cqes[cq_head & *batch->cq_mask];
+      batch->ops[cqe->user_data].ret = cqe->res;
+    }
+    __atomic_store_n(batch->cq_head, cq_head, __ATOMIC_RELEASE);
+    if (reaped < n &&
+        syscall(__NR_io_uring_enter, batch->ring_fd, 0, (unsigned int) (n - reaped),
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#endif
+
+int energymon_pread_batch_init(energymon_pread_batch* batch, energymon_pread_op* ops, size_t n,
+                               int use_io_uring) {
+  if (batch == NULL || (ops == NULL && n > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(batch, 0, sizeof(*batch));
+  batch->ops = ops;
+  batch->n = n;
+  batch->ring_fd = -1;
+#ifdef ENERGYMON_USE_IO_URING
+  int err_save = errno;
+  if (use_io_uring && n > 0 && ring_init(batch)) {
+    // e.g., ENOSYS on old kernels, or EPERM if disabled by the administrator
+    errno = err_save;
+  }
+#else
+  (void) use_io_uring;
+#endif
+  return 0;
+}
+
+int energymon_pread_batch_read(energymon_pread_batch* batch, size_t n) {
+  size_t i;
+  if (n > batch->n) {
+    errno = EINVAL;
+    return -1;
+  }
+#ifdef ENERGYMON_USE_IO_URING
+  if (batch->ring_fd >= 0) {
+    if (ring_read(batch, n) == 0) {
+      for (i = 0; i < n; i++) {
+        if (batch->ops[i].ret < 0) {
+          errno = (int) -batch->ops[i].ret;
+          batch->ops[i].ret = -1;
+          return -1;
+        }
+      }
+      return 0;
+    }
+    // don't risk using the ring again
+    ring_destroy(batch);
+  }
+#endif
+  for (i = 0; i < n; i++) {
+    if ((batch->ops[i].ret = pread(batch->ops[i].fd, batch->ops[i].buf, batch->ops[i].len, 0)) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int energymon_pread_batch_is_io_uring(const energymon_pread_batch* batch) {
+  return batch->ring_fd >= 0;
+}
+
+int energymon_pread_batch_destroy(energymon_pread_batch* batch) {
+  if (batch == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+#ifdef ENERGYMON_USE_IO_URING
+  ring_destroy(batch);
+#endif
+  return 0;
+}
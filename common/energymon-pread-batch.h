@@ -0,0 +1,100 @@
+/**
+ * Internal utility for batching pread operations across file descriptors.
+ */
+#ifndef _ENERGYMON_PREAD_BATCH_H_
+#define _ENERGYMON_PREAD_BATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * A read of up to len bytes from offset 0 of fd into buf.
+ */
+typedef struct energymon_pread_op {
+  int fd;
+  void* buf;
+  size_t len;
+  // the number of bytes read by the last batch
+  ssize_t ret;
+} energymon_pread_op;
+
+/**
+ * A fixed set of read operations that are performed together.
+ * With io_uring, all reads are submitted and reaped in a single system call.
+ * Otherwise, reads are performed in a loop of pread calls.
+ */
+typedef struct energymon_pread_batch {
+  energymon_pread_op* ops;
+  size_t n;
+  // io_uring file descriptor, or -1 if not using io_uring
+  int ring_fd;
+  void* sq_ptr;
+  size_t sq_len;
+  void* cq_ptr;
+  size_t cq_len;
+  void* sqes;
+  size_t sqes_len;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  void* cqes;
+  void* iovs;
+} energymon_pread_batch;
+
+/**
+ * Initialize a batch.
+ * The ops array must remain valid, and its fd, buf, and len fields must not
+ * change until the batch is destroyed.
+ * If io_uring is requested but not available, the batch silently falls back on
+ * a pread loop.
+ *
+ * @param batch
+ * @param ops
+ *  the read operations
+ * @param n
+ *  the number of read operations
+ * @param use_io_uring
+ *  non-zero to try using io_uring
+ * @return 0 on success, -1 on failure
+ */
+int energymon_pread_batch_init(energymon_pread_batch* batch, energymon_pread_op* ops, size_t n,
+                               int use_io_uring);
+
+/**
+ * Perform the first n read operations, setting each op's ret field.
+ *
+ * @param batch
+ * @param n
+ *  the number of operations to perform, at most the number at initialization
+ * @return 0 on success, -1 if any read failed (errno is set from the first)
+ */
+int energymon_pread_batch_read(energymon_pread_batch* batch, size_t n);
+
+/**
+ * @return non-zero if the batch is using io_uring, 0 otherwise
+ */
+int energymon_pread_batch_is_io_uring(const energymon_pread_batch* batch);
+
+/**
+ * Release batch resources (but not the ops array or file descriptors).
+ *
+ * @return 0 on success, -1 on failure
+ */
+int energymon_pread_batch_destroy(energymon_pread_batch* batch);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
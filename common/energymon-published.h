@@ -0,0 +1,186 @@
+/**
+ * Internal utility for publishing samples from a polling thread to readers.
+ */
+#ifndef _ENERGYMON_PUBLISHED_H_
+#define _ENERGYMON_PUBLISHED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include "energymon.h"
+#include "energymon-time-util.h"
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * The most recent sample from a single writer (e.g., a polling thread).
+ * A seqlock protects the fields: seq is odd while the writer is updating, and
+ * readers retry if it was odd or changed while they were reading.
+ * Readers never block the writer, and never see a torn or mixed sample.
+ * Zero-initialization is a valid initial state.
+ */
+typedef struct energymon_published {
+  uint64_t seq;
+  uint64_t energy_uj;
+  // monotonic time that the sample was taken, in nanoseconds
+  uint64_t time_ns;
+  // the power over the interval ending at time_ns in microwatts, if known
+  uint64_t power_uw;
+  // the number of samples published
+  uint64_t id;
+} energymon_published;
+
+/**
+ * A consistent copy of a published sample.
+ */
+typedef struct energymon_published_sample {
+  uint64_t energy_uj;
+  uint64_t time_ns;
+  uint64_t power_uw;
+  uint64_t id;
+} energymon_published_sample;
+
+/**
+ * Publish a new sample (single writer only).
+ */
+static inline void energymon_published_store(energymon_published* p, uint64_t energy_uj, uint64_t time_ns,
+                                             uint64_t power_uw) {
+  uint64_t seq = __atomic_load_n(&p->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&p->energy_uj, energy_uj, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->time_ns, time_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->power_uw, power_uw, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->id, __atomic_load_n(&p->id, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Read the most recent sample (any number of readers).
+ */
+static inline void energymon_published_load(const energymon_published* p, energymon_published_sample* s) {
+  uint64_t seq;
+  do {
+    while ((seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE)) & 1) {
+      // writer is updating
+    }
+    s->energy_uj = __atomic_load_n(&p->energy_uj, __ATOMIC_RELAXED);
+    s->time_ns = __atomic_load_n(&p->time_ns, __ATOMIC_RELAXED);
+    s->power_uw = __atomic_load_n(&p->power_uw, __ATOMIC_RELAXED);
+    s->id = __atomic_load_n(&p->id, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/**
+ * Read the most recent energy value (any number of readers).
+ */
+static inline uint64_t energymon_published_energy(const energymon_published* p) {
+  // energy is only ever stored whole, so it doesn't need the seqlock
+  return __atomic_load_n(&p->energy_uj, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Estimate the current energy by extrapolating the most recent power over the
+ * time since the most recent sample.
+ * Extrapolated values may exceed the energy of the next sample (e.g., if the
+ * power drops), so if floor is not NULL, it's atomically raised to each result
+ * and results never go below it, i.e., never decrease.
+ *
+ * @param p
+ * @param floor
+ *  the largest value returned so far, or NULL
+ * @param now_ns
+ *  the current monotonic time in nanoseconds
+ * @param max_ns
+ *  the maximum time to extrapolate over (e.g., the polling interval), or 0 for no limit
+ * @return the energy estimate in microjoules
+ */
+static inline uint64_t energymon_published_extrapolate(const energymon_published* p, uint64_t* floor,
+                                                       uint64_t now_ns, uint64_t max_ns) {
+  energymon_published_sample s;
+  uint64_t dt_ns;
+  uint64_t prev;
+  energymon_published_load(p, &s);
+  if (now_ns > s.time_ns) {
+    dt_ns = now_ns - s.time_ns;
+    if (max_ns > 0 && dt_ns > max_ns) {
+      dt_ns = max_ns;
+    }
+    s.energy_uj += s.power_uw * (dt_ns / 1000) / 1000000;
+  }
+  if (floor != NULL) {
+    prev = __atomic_load_n(floor, __ATOMIC_RELAXED);
+    while (prev < s.energy_uj &&
+           !__atomic_compare_exchange_n(floor, &prev, s.energy_uj, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      // another reader raised the floor
+    }
+    if (prev > s.energy_uj) {
+      return prev;
+    }
+  }
+  return s.energy_uj;
+}
+
+/**
+ * Read the most recent energy value and the monotonic time it corresponds to:
+ * the time of the most recent sample, or the current time if extrapolating or
+ * if nothing has been published yet.
+ *
+ * @param p
+ * @param extrapolate
+ *  whether to extrapolate (see energymon_published_extrapolate)
+ * @param floor
+ * @param max_ns
+ * @param time_ns
+ *  must not be NULL
+ * @return the energy in microjoules
+ */
+static inline uint64_t energymon_published_read(const energymon_published* p, int extrapolate, uint64_t* floor,
+                                                uint64_t max_ns, uint64_t* time_ns) {
+  energymon_published_sample s;
+  if (extrapolate) {
+    *time_ns = energymon_gettime_ns();
+    return energymon_published_extrapolate(p, floor, *time_ns, max_ns);
+  }
+  energymon_published_load(p, &s);
+  *time_ns = s.id ? s.time_ns : energymon_gettime_ns();
+  return s.energy_uj;
+}
+
+/**
+ * Implementation of energymon_read_samples for energymons that publish samples.
+ * Timestamps are as described in energymon_published_read, so repeated samples
+ * without extrapolation share the time of the most recent poll.
+ *
+ * @param p
+ * @param extrapolate
+ * @param floor
+ * @param max_ns
+ * @param samples
+ *  must not be NULL if n > 0
+ * @param n
+ * @return n
+ */
+static inline size_t energymon_published_read_samples(const energymon_published* p, int extrapolate,
+                                                      uint64_t* floor, uint64_t max_ns,
+                                                      energymon_sample* samples, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    samples[i].energy_uj = energymon_published_read(p, extrapolate, floor, max_ns, &samples[i].time_ns);
+  }
+  errno = 0;
+  return n;
+}
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
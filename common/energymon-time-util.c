@@ -4,7 +4,9 @@
  * @author Connor Imes
  * @date 2015-12-24
  */
+#include <errno.h>
 #include <inttypes.h>
+#include <time.h>
 #include "energymon-time-util.h"
 #include "ptime/ptime.h"
 
@@ -23,3 +25,59 @@ uint64_t energymon_gettime_elapsed_us(uint64_t* since_us) {
 int energymon_sleep_us(uint64_t us, volatile const int* ignore_interrupt) {
   return ptime_sleep_us_no_interrupt(us, ignore_interrupt);
 }
+
+int energymon_periodic_init(energymon_periodic* p, uint64_t interval_us) {
+  uint64_t now_ns = energymon_gettime_ns();
+  if (!now_ns) {
+    return -1;
+  }
+  p->interval_ns = interval_us * 1000;
+  p->deadline_ns = now_ns + p->interval_ns;
+  p->overruns = 0;
+  return 0;
+}
+
+uint64_t energymon_periodic_advance(energymon_periodic* p, uint64_t now_ns) {
+  uint64_t passed;
+  if (now_ns < p->deadline_ns) {
+    return 0;
+  }
+  // keep the original phase rather than restarting the schedule from now
+  passed = p->interval_ns ? (now_ns - p->deadline_ns) / p->interval_ns + 1 : 1;
+  p->deadline_ns += passed * p->interval_ns;
+  return passed;
+}
+
+int energymon_periodic_wait(energymon_periodic* p, volatile const int* ignore_interrupt) {
+  uint64_t now_ns = energymon_gettime_ns();
+  uint64_t missed;
+  if (!now_ns) {
+    return -1;
+  }
+  if ((missed = energymon_periodic_advance(p, now_ns)) > 0) {
+    p->overruns += missed;
+    return 0;
+  }
+#if defined(__MACH__) || defined(_WIN32)
+  // no clock_nanosleep, but relative sleeps from an absolute deadline don't accumulate drift
+  if (energymon_sleep_us((p->deadline_ns - now_ns) / 1000, ignore_interrupt)) {
+    p->deadline_ns += p->interval_ns;
+    return -1;
+  }
+#else
+  int ret;
+  struct timespec ts;
+  ts.tv_sec = (time_t) (p->deadline_ns / 1000000000);
+  ts.tv_nsec = (long) (p->deadline_ns % 1000000000);
+  do {
+    ret = clock_nanosleep(ENERGYMON_CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  } while (ret == EINTR && (ignore_interrupt == NULL ? 1 : *ignore_interrupt));
+  if (ret) {
+    p->deadline_ns += p->interval_ns;
+    errno = ret;
+    return -1;
+  }
+#endif
+  p->deadline_ns += p->interval_ns;
+  return 0;
+}
@@ -9,6 +9,20 @@ extern "C" {
 #endif
 
 #include <inttypes.h>
+#include <time.h>
+
+#if !defined(__MACH__) && !defined(_WIN32)
+// deadlines must use the same clock as ptime's PTIME_MONOTONIC
+#if defined(CLOCK_MONOTONIC_PRECISE)
+#define ENERGYMON_CLOCK_MONOTONIC CLOCK_MONOTONIC_PRECISE
+#elif defined(CLOCK_HIGHRES)
+#define ENERGYMON_CLOCK_MONOTONIC CLOCK_HIGHRES
+#elif defined(CLOCK_MONOTONIC)
+#define ENERGYMON_CLOCK_MONOTONIC CLOCK_MONOTONIC
+#else
+#define ENERGYMON_CLOCK_MONOTONIC CLOCK_REALTIME
+#endif
+#endif
 
 #pragma GCC visibility push(hidden)
 
@@ -46,6 +60,56 @@ uint64_t energymon_gettime_elapsed_us(uint64_t* since_us);
  */
 int energymon_sleep_us(uint64_t us, volatile const int* ignore_interrupt);
 
+/**
+ * A periodic schedule with absolute deadlines.
+ * Time spent between waits doesn't delay subsequent deadlines, so the period
+ * doesn't drift.
+ */
+typedef struct energymon_periodic {
+  uint64_t interval_ns;
+  // the next deadline, in monotonic nanoseconds
+  uint64_t deadline_ns;
+  // the number of deadlines that had already passed when waiting
+  uint64_t overruns;
+} energymon_periodic;
+
+/**
+ * Start a periodic schedule - the first deadline is one interval from now.
+ *
+ * @param p
+ *  must not be NULL
+ * @param interval_us
+ *  the period in microseconds
+ * @return 0 on success, -1 on failure
+ */
+int energymon_periodic_init(energymon_periodic* p, uint64_t interval_us);
+
+/**
+ * Skip past any deadlines that have passed, without sleeping.
+ * Keeps the original phase rather than restarting the schedule from now.
+ * Doesn't count overruns - that's up to the caller.
+ *
+ * @param p
+ *  must not be NULL
+ * @param now_ns
+ *  the current monotonic time in nanoseconds
+ * @return the number of deadlines that passed, 0 if the next deadline hasn't
+ */
+uint64_t energymon_periodic_advance(energymon_periodic* p, uint64_t now_ns);
+
+/**
+ * Sleep until the next deadline.
+ * If the deadline already passed, returns immediately, counts the overrun(s),
+ * and skips to the first deadline that hasn't passed.
+ *
+ * @param p
+ *  must not be NULL
+ * @param ignore_interrupt
+ *  whether to ignore interrupts (true if not specified)
+ * @return 0 on success, -1 on failure
+ */
+int energymon_periodic_wait(energymon_periodic* p, volatile const int* ignore_interrupt);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
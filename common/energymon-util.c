@@ -6,6 +6,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include "energymon-util.h"
 
@@ -27,3 +28,22 @@ char* energymon_strencpy(char* dest, const char* src, size_t n) {
   }
   return dest;
 }
+
+int energymon_parse_u64(const char* buf, size_t len, uint64_t* val) {
+  uint64_t v = 0;
+  unsigned int d;
+  size_t i;
+  for (i = 0; i < len && (d = (unsigned int) (buf[i] - '0')) <= 9; i++) {
+    if (v > (UINT64_MAX - d) / 10) {
+      errno = ERANGE;
+      return -1;
+    }
+    v = v * 10 + d;
+  }
+  if (i == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  *val = v;
+  return 0;
+}
@@ -8,6 +8,7 @@
 extern "C" {
 #endif
 
+#include <inttypes.h>
 #include <stddef.h>
 
 #pragma GCC visibility push(hidden)
@@ -26,6 +27,22 @@ extern "C" {
  */
 char* energymon_strencpy(char* dest, const char* src, size_t n);
 
+/**
+ * Parse an unsigned decimal integer, e.g., from a sysfs file.
+ * Stops at the first non-digit character, so trailing newlines are permitted.
+ * Much cheaper than strtoull, which handles locales, signs, and bases.
+ *
+ * @param buf
+ *  the buffer to parse, need not be null-terminated
+ * @param len
+ *  the number of bytes in buf
+ * @param val
+ *  the parsed value
+ * @return 0 on success, -1 on failure (errno is set to EINVAL if there are no
+ *         leading digits or ERANGE on overflow)
+ */
+int energymon_parse_u64(const char* buf, size_t len, uint64_t* val);
+
 #pragma GCC visibility pop
 
 #ifdef __cplusplus
@@ -6,14 +6,27 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "energymon.h"
 #include "energymon-cray-pm-common.h"
+#include "energymon-util.h"
 
-int energymon_cray_pm_common_init(energymon* em, const char* file) {
+int energymon_cray_pm_common_open(const char* file) {
   assert(file != NULL);
+  char buf[64];
+  int fd;
+  snprintf(buf, sizeof(buf), CRAY_PM_BASE_DIR"/%s", file);
+  if ((fd = open(buf, O_RDONLY)) < 0) {
+    perror(buf);
+  }
+  return fd;
+}
+
+int energymon_cray_pm_common_init(energymon* em, const char* file) {
   if (em == NULL || em->state != NULL) {
     errno = EINVAL;
     return -1;
@@ -22,10 +35,7 @@ int energymon_cray_pm_common_init(energymon* em, const char* file) {
   if (state == NULL) {
     return -1;
   }
-  char buf[64];
-  snprintf(buf, sizeof(buf), CRAY_PM_BASE_DIR"/%s", file);
-  if ((state->f = fopen(buf, "r")) == NULL) {
-    perror(buf);
+  if ((state->fd = energymon_cray_pm_common_open(file)) < 0) {
     free(state);
     return -1;
   }
@@ -38,11 +48,13 @@ uint64_t energymon_cray_pm_common_read_total(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
-  const energymon_cray_pm_common* state = (energymon_cray_pm_common*) em->state;
-  uint64_t joules = 0;
+  energymon_cray_pm_common* state = (energymon_cray_pm_common*) em->state;
+  uint64_t joules;
+  ssize_t ret;
   errno = 0;
-  rewind(state->f);
-  if (fscanf(state->f, "%"PRIu64" J", &joules) != 1) {
+  // values are formatted like "12345 J", the unit suffix is ignored
+  if ((ret = pread(state->fd, state->buf, sizeof(state->buf), 0)) < 0 ||
+      energymon_parse_u64(state->buf, (size_t) ret, &joules)) {
     return 0;
   }
   return joules * 1000000;
@@ -54,12 +66,10 @@ int energymon_cray_pm_common_finish(energymon* em) {
     return -1;
   }
   const energymon_cray_pm_common* state = (energymon_cray_pm_common*) em->state;
-  if (state->f != NULL) {
-    fclose(state->f);
-  }
+  int ret = close(state->fd);
   free(em->state);
   em->state = NULL;
-  return 0;
+  return ret;
 }
 
 uint64_t energymon_cray_pm_common_get_interval(const energymon* em) {
@@ -13,17 +13,27 @@ extern "C" {
 
 #include <inttypes.h>
 #include <stddef.h>
-#include <stdio.h>
 #include "energymon.h"
 
 #pragma GCC visibility push(hidden)
 
 #define CRAY_PM_BASE_DIR "/sys/cray/pm_counters"
 
+// large enough for a 20-digit value, a unit suffix (e.g., " J"), and a newline
+#define CRAY_PM_BUF_LEN 32
+
 typedef struct energymon_cray_pm_common {
-  FILE* f;
+  int fd;
+  char buf[CRAY_PM_BUF_LEN];
 } energymon_cray_pm_common;
 
+/**
+ * Open a file in CRAY_PM_BASE_DIR for reading with pread.
+ *
+ * @return the file descriptor, or -1 on failure
+ */
+int energymon_cray_pm_common_open(const char* file);
+
 int energymon_cray_pm_common_init(energymon* em, const char* file);
 
 uint64_t energymon_cray_pm_common_read_total(const energymon* em);
@@ -9,13 +9,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-cray-pm.h"
 #include "energymon-cray-pm-common.h"
-#include "energymon-cray-pm-energy.h"
-#include "energymon-cray-pm-accel_energy.h"
-#include "energymon-cray-pm-cpu_energy.h"
-#include "energymon-cray-pm-memory_energy.h"
+#include "energymon-pread-batch.h"
 #include "energymon-util.h"
 
 #ifdef ENERGYMON_DEFAULT_CRAY_PM
@@ -23,6 +22,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_cray_pm(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_cray_pm(ext);
+}
 #endif
 
 typedef enum energymon_cray_pm_file {
@@ -33,15 +35,33 @@ typedef enum energymon_cray_pm_file {
   FILE_COUNT
 } energymon_cray_pm_file;
 
+static const char* const CRAY_PM_FILES[FILE_COUNT] = {
+  [FILE_ENERGY] = ENERGYMON_CRAY_PM_COUNTER_ENERGY,
+  [FILE_ACCEL_ENERGY] = ENERGYMON_CRAY_PM_COUNTER_ACCEL_ENERGY,
+  [FILE_CPU_ENERGY] = ENERGYMON_CRAY_PM_COUNTER_CPU_ENERGY,
+  [FILE_MEMORY_ENERGY] = ENERGYMON_CRAY_PM_COUNTER_MEMORY_ENERGY,
+};
+
+// ops are the freshness file, then each counter file, then the freshness file again
+#define CRAY_PM_OPS_MAX (FILE_COUNT + 2)
+
 typedef struct energymon_cray_pm {
-  energymon file[FILE_COUNT];
-  int has_file[FILE_COUNT];
-  FILE* f_freshness;
+  int fd_freshness;
+  // -1 if not used
+  int fd[FILE_COUNT];
+  unsigned int n_files;
+  // the counter file read by ops[i + 1]
+  energymon_cray_pm_file files[FILE_COUNT];
+  energymon_pread_op ops[CRAY_PM_OPS_MAX];
+  char bufs[CRAY_PM_OPS_MAX][CRAY_PM_BUF_LEN];
+  energymon_pread_batch batch;
+  // whether batch needs to be destroyed
+  int batch_init;
 } energymon_cray_pm;
 
 static int cray_pm_open_files(energymon_cray_pm* state) {
   int ret = 0;
-  energymon* em;
+  unsigned int i;
   char* saveptr;
   char* tmp;
   const char* tok;
@@ -56,47 +76,8 @@ static int cray_pm_open_files(energymon_cray_pm* state) {
     }
     tok = strtok_r(tmp, ",", &saveptr);
     while (tok != NULL) {
-      if (strncmp(tok, ENERGYMON_CRAY_PM_COUNTER_ENERGY, sizeof(ENERGYMON_CRAY_PM_COUNTER_ENERGY)) == 0) {
-        if (!state->has_file[FILE_ENERGY]) {
-          em = &state->file[FILE_ENERGY];
-          energymon_get_cray_pm_energy(em);
-          if (em->finit(em)) {
-            ret = -1;
-            break;
-          }
-          state->has_file[FILE_ENERGY] = 1;
-        }
-      } else if (strncmp(tok, ENERGYMON_CRAY_PM_COUNTER_ACCEL_ENERGY, sizeof(ENERGYMON_CRAY_PM_COUNTER_ACCEL_ENERGY)) == 0) {
-        if (!state->has_file[FILE_ACCEL_ENERGY]) {
-          em = &state->file[FILE_ACCEL_ENERGY];
-          energymon_get_cray_pm_accel_energy(em);
-          if (em->finit(em)) {
-            ret = -1;
-            break;
-          }
-          state->has_file[FILE_ACCEL_ENERGY] = 1;
-        }
-      } else if (strncmp(tok, ENERGYMON_CRAY_PM_COUNTER_CPU_ENERGY, sizeof(ENERGYMON_CRAY_PM_COUNTER_CPU_ENERGY)) == 0) {
-        if (!state->has_file[FILE_CPU_ENERGY]) {
-          em = &state->file[FILE_CPU_ENERGY];
-          energymon_get_cray_pm_cpu_energy(em);
-          if (em->finit(em)) {
-            ret = -1;
-            break;
-          }
-          state->has_file[FILE_CPU_ENERGY] = 1;
-        }
-      } else if (strncmp(tok, ENERGYMON_CRAY_PM_COUNTER_MEMORY_ENERGY, sizeof(ENERGYMON_CRAY_PM_COUNTER_MEMORY_ENERGY)) == 0) {
-        if (!state->has_file[FILE_MEMORY_ENERGY]) {
-          em = &state->file[FILE_MEMORY_ENERGY];
-          energymon_get_cray_pm_memory_energy(em);
-          if (em->finit(em)) {
-            ret = -1;
-            break;
-          }
-          state->has_file[FILE_MEMORY_ENERGY] = 1;
-        }
-      } else {
+      for (i = 0; i < FILE_COUNT && strcmp(tok, CRAY_PM_FILES[i]); i++);
+      if (i == FILE_COUNT) {
         // unknown token
         fprintf(stderr, "cray_pm_open_files: Unknown token in environment variable %s: %s\n",
                 ENERGYMON_CRAY_PM_COUNTERS_ENV_VAR, tok);
@@ -104,6 +85,13 @@ static int cray_pm_open_files(energymon_cray_pm* state) {
         errno = EINVAL;
         break;
       }
+      if (state->fd[i] < 0) {
+        if ((state->fd[i] = energymon_cray_pm_common_open(CRAY_PM_FILES[i])) < 0) {
+          ret = -1;
+          break;
+        }
+        state->n_files++;
+      }
       tok = strtok_r(NULL, ",", &saveptr);
     }
     free(tmp);
@@ -111,23 +99,49 @@ static int cray_pm_open_files(energymon_cray_pm* state) {
   return ret;
 }
 
+static int cray_pm_init_batch(energymon_cray_pm* state) {
+  unsigned int i;
+  unsigned int n = 0;
+  state->ops[n++].fd = state->fd_freshness;
+  for (i = 0; i < FILE_COUNT; i++) {
+    if (state->fd[i] >= 0) {
+      state->files[n - 1] = (energymon_cray_pm_file) i;
+      state->ops[n++].fd = state->fd[i];
+    }
+  }
+  state->ops[n++].fd = state->fd_freshness;
+  for (i = 0; i < n; i++) {
+    state->ops[i].buf = state->bufs[i];
+    state->ops[i].len = sizeof(state->bufs[i]);
+  }
+  // io_uring doesn't order the reads, but the freshness reads must bracket the counter reads
+  if (energymon_pread_batch_init(&state->batch, state->ops, n, 0)) {
+    return -1;
+  }
+  state->batch_init = 1;
+  return 0;
+}
+
 int energymon_init_cray_pm(energymon* em) {
   if (em == NULL || em->state != NULL) {
     errno = EINVAL;
     return -1;
   }
   int err_save;
+  unsigned int i;
   energymon_cray_pm* state = calloc(1, sizeof(energymon_cray_pm));
   if (state == NULL) {
     return -1;
   }
-  if ((state->f_freshness = fopen(CRAY_PM_BASE_DIR"/freshness", "r")) == NULL) {
-    perror(CRAY_PM_BASE_DIR"/freshness");
+  for (i = 0; i < FILE_COUNT; i++) {
+    state->fd[i] = -1;
+  }
+  if ((state->fd_freshness = energymon_cray_pm_common_open("freshness")) < 0) {
     free(state);
     return -1;
   }
   em->state = state;
-  if (cray_pm_open_files(state)) {
+  if (cray_pm_open_files(state) || cray_pm_init_batch(state)) {
     err_save = errno;
     energymon_finish_cray_pm(em);
     errno = err_save;
@@ -136,45 +150,108 @@ int energymon_init_cray_pm(energymon* em) {
   return 0;
 }
 
+/**
+ * Read the selected counters (in Joules) from the same update, indexed by file.
+ */
+static int cray_pm_read_counters(energymon_cray_pm* state, uint64_t joules[FILE_COUNT], uint64_t* freshness) {
+  unsigned int i;
+  uint64_t fresh_end;
+  const energymon_pread_op* ops = state->ops;
+  memset(joules, 0, FILE_COUNT * sizeof(uint64_t));
+  // don't let the counters update in the middle of reading - check freshness
+  do {
+    // read all files in a single pass, then parse (values are formatted like "12345 J", the unit suffix is ignored)
+    if (energymon_pread_batch_read(&state->batch, state->n_files + 2) ||
+        energymon_parse_u64(ops[0].buf, (size_t) ops[0].ret, freshness) ||
+        energymon_parse_u64(ops[state->n_files + 1].buf, (size_t) ops[state->n_files + 1].ret, &fresh_end)) {
+      return -1;
+    }
+  } while (*freshness != fresh_end);
+  for (i = 0; i < state->n_files; i++) {
+    if (energymon_parse_u64(ops[i + 1].buf, (size_t) ops[i + 1].ret, &joules[state->files[i]])) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
 uint64_t energymon_read_total_cray_pm(const energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
     return 0;
   }
   unsigned int i;
-  uint64_t joules;
-  uint64_t tmp;
-  uint64_t fresh_start = 1;
-  uint64_t fresh_end = 0;
+  uint64_t joules[FILE_COUNT];
+  uint64_t freshness;
+  uint64_t total = 0;
+  errno = 0;
+  if (cray_pm_read_counters((energymon_cray_pm*) em->state, joules, &freshness)) {
+    return 0;
+  }
+  for (i = 0; i < FILE_COUNT; i++) {
+    total += joules[i];
+  }
+  return total * 1000000;
+}
+
+int energymon_read_snapshot_cray_pm(const energymon* em, energymon_cray_pm_snapshot* snapshot) {
+  if (em == NULL || em->state == NULL || snapshot == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  uint64_t joules[FILE_COUNT];
+  if (cray_pm_read_counters((energymon_cray_pm*) em->state, joules, &snapshot->freshness)) {
+    return -1;
+  }
+  snapshot->energy_uj = joules[FILE_ENERGY] * 1000000;
+  snapshot->accel_energy_uj = joules[FILE_ACCEL_ENERGY] * 1000000;
+  snapshot->cpu_energy_uj = joules[FILE_CPU_ENERGY] * 1000000;
+  snapshot->memory_energy_uj = joules[FILE_MEMORY_ENERGY] * 1000000;
+  return 0;
+}
+
+uint64_t energymon_read_freshness_cray_pm(const energymon* em) {
+  if (em == NULL || em->state == NULL) {
+    errno = EINVAL;
+    return 0;
+  }
   const energymon_cray_pm* state = (energymon_cray_pm*) em->state;
-  if (state->f_freshness == NULL) {
+  char buf[CRAY_PM_BUF_LEN];
+  uint64_t freshness;
+  ssize_t ret;
+  errno = 0;
+  if ((ret = pread(state->fd_freshness, buf, sizeof(buf), 0)) < 0 ||
+      energymon_parse_u64(buf, (size_t) ret, &freshness)) {
+    return 0;
+  }
+  return freshness;
+}
+
+size_t energymon_read_channels_cray_pm(const energymon* em, energymon_channel* channels, size_t n) {
+  if (em == NULL || em->state == NULL || (channels == NULL && n > 0)) {
     errno = EINVAL;
     return 0;
   }
-  // don't let the counters update in the middle of reading - check freshness
-  while (fresh_start != fresh_end) {
-    errno = 0;
-    joules = 0;
-    rewind(state->f_freshness);
-    if (fscanf(state->f_freshness, "%"PRIu64, &fresh_start) != 1) {
-      return 0;
-    }
-    for (i = 0; i < FILE_COUNT; i++) {
-      if (state->has_file[i]) {
-        errno = 0;
-        tmp = state->file[i].fread(&state->file[i]);
-        if (tmp == 0 && errno) {
-          return 0;
-        }
-        joules += tmp;
-      }
-    }
-    rewind(state->f_freshness);
-    if (fscanf(state->f_freshness, "%"PRIu64, &fresh_end) != 1) {
-      return 0;
-    }
+  energymon_cray_pm* state = (energymon_cray_pm*) em->state;
+  uint64_t joules[FILE_COUNT];
+  uint64_t freshness;
+  unsigned int i;
+  if (n == 0) {
+    return state->n_files;
+  }
+  if (n < state->n_files) {
+    errno = ENOBUFS;
+    return 0;
+  }
+  // all channels are from the same update
+  if (cray_pm_read_counters(state, joules, &freshness)) {
+    return 0;
+  }
+  for (i = 0; i < state->n_files; i++) {
+    channels[i].energy_uj = joules[state->files[i]] * 1000000;
+    energymon_strencpy(channels[i].name, CRAY_PM_FILES[state->files[i]], sizeof(channels[i].name));
   }
-  return joules * 1000000;
+  return state->n_files;
 }
 
 int energymon_finish_cray_pm(energymon* em) {
@@ -185,17 +262,18 @@ int energymon_finish_cray_pm(energymon* em) {
   unsigned int i;
   int err_save = 0;
   energymon_cray_pm* state = (energymon_cray_pm*) em->state;
+  if (state->batch_init) {
+    energymon_pread_batch_destroy(&state->batch);
+  }
   for (i = 0; i < FILE_COUNT; i++) {
-    if (state->has_file[i]) {
-      if (state->file[i].ffinish(&state->file[i]) && !err_save) {
+    if (state->fd[i] >= 0) {
+      if (close(state->fd[i]) && !err_save) {
         err_save = errno;
       }
     }
   }
-  if (state->f_freshness != NULL) {
-    if (fclose(state->f_freshness) && !err_save) {
-      err_save = errno;
-    }
+  if (close(state->fd_freshness) && !err_save) {
+    err_save = errno;
   }
   free(em->state);
   em->state = NULL;
@@ -237,3 +315,13 @@ int energymon_get_cray_pm(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_cray_pm(energymon_ext* ext) {
+  if (energymon_get_ext_fallback(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_channels)) {
+    ext->fread_channels = &energymon_read_channels_cray_pm;
+  }
+  return 0;
+}
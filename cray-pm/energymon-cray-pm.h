@@ -39,6 +39,42 @@ int energymon_is_exclusive_cray_pm(void);
 
 int energymon_get_cray_pm(energymon* em);
 
+/**
+ * A consistent snapshot of the selected counters, all from the same Cray PM update.
+ * Counters that aren't selected in ENERGYMON_CRAY_PM_COUNTERS_ENV_VAR are 0.
+ */
+typedef struct energymon_cray_pm_snapshot {
+  // the value of the "freshness" counter, which changes with each update
+  uint64_t freshness;
+  uint64_t energy_uj;
+  uint64_t accel_energy_uj;
+  uint64_t cpu_energy_uj;
+  uint64_t memory_energy_uj;
+} energymon_cray_pm_snapshot;
+
+/**
+ * Read all selected counters from the same update.
+ * The freshness counter is read before and after the other counters, and reads are retried until it doesn't change.
+ *
+ * @param em
+ * @param snapshot
+ *  must not be NULL
+ * @return 0 on success, -1 on failure
+ */
+int energymon_read_snapshot_cray_pm(const energymon* em, energymon_cray_pm_snapshot* snapshot);
+
+/**
+ * Read only the freshness counter, e.g., to skip reading a snapshot if it hasn't changed since the last one.
+ *
+ * @param em
+ * @return the freshness value, or 0 on failure (check errno)
+ */
+uint64_t energymon_read_freshness_cray_pm(const energymon* em);
+
+size_t energymon_read_channels_cray_pm(const energymon* em, energymon_channel* channels, size_t n);
+
+int energymon_get_ext_cray_pm(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,29 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to extrapolate energy between samples using the most recent power reading.
+ */
+#define ENERGYMON_IBMPOWERNV_EXTRAPOLATE "ENERGYMON_IBMPOWERNV_EXTRAPOLATE"
+
+/*
+ * Environment variable to select the rule for integrating power samples into energy:
+ * "rectangle" (default), "trapezoid", or "window" (the sensor's averaging window).
+ */
+#define ENERGYMON_IBMPOWERNV_INTEGRATION "ENERGYMON_IBMPOWERNV_INTEGRATION"
+
+/*
+ * Environment variable to enable adaptive polling: while the power is flat, the polling interval backs off up to this
+ * many microseconds, and returns to the minimum when the power changes.
+ */
+#define ENERGYMON_IBMPOWERNV_INTERVAL_MAX_US "ENERGYMON_IBMPOWERNV_INTERVAL_MAX_US"
+
+/*
+ * Environment variable to override the minimum adaptive polling interval in microseconds (defaults to the sensor update
+ * interval).
+ */
+#define ENERGYMON_IBMPOWERNV_INTERVAL_MIN_US "ENERGYMON_IBMPOWERNV_INTERVAL_MIN_US"
+
 int energymon_init_ibmpowernv_power(energymon* em);
 
 uint64_t energymon_read_total_ibmpowernv_power(const energymon* em);
@@ -31,6 +54,10 @@ int energymon_is_exclusive_ibmpowernv_power(void);
 
 int energymon_get_ibmpowernv_power(energymon* em);
 
+size_t energymon_read_samples_ibmpowernv_power(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_ibmpowernv_power(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,9 +17,12 @@
 #include <sensors.h>
 #include <error.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
-#include <pthread.h>
 #include "energymon-ibmpowernv-power.h"
+#include "energymon-integrate.h"
+#include "energymon-poller.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #else
 #include "energymon-ibmpowernv.h"
@@ -35,6 +38,11 @@ int energymon_get_default(energymon* em) {
   return energymon_get_ibmpowernv(em);
 #endif
 }
+#ifdef ENERGYMON_IBMPOWERNV_USE_POWER
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_ibmpowernv_power(ext);
+}
+#endif
 #endif
 
 #define ENERGYMON_IBMPOWERNV_CHIP_NAME_PREFIX "ibmpowernv"
@@ -68,44 +76,41 @@ typedef struct energymon_ibmpowernv {
   const sensors_chip_name* cn;
   int subfeat_nr;
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
-  // thread variables
-  pthread_t thread;
-  int poll_sensors;
-  // total energy estimate
+  // shared polling thread registration
+  energymon_poller_task task;
+  int polling;
+  uint64_t last_us;
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
+  energymon_integrator integ;
+  // adapts the polling interval to the power signal
+  energymon_poller_adaptive adapt;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // extrapolate reads from the most recent sample, never returning less than extrapolated_uj
+  int extrapolate;
+  uint64_t extrapolated_uj;
 #endif
 } energymon_ibmpowernv;
 
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
 /**
- * pthread function to poll the sensors at regular intervals.
+ * Poller function to read the sensors at regular intervals.
  */
-static void* ibmpowernv_poll_sensor(void* args) {
+static void ibmpowernv_poll_sensor(void* args) {
   energymon_ibmpowernv* state = (energymon_ibmpowernv*) args;
   double w;
   uint64_t exec_us;
-  uint64_t last_us;
   int rc;
-  if (!(last_us = energymon_gettime_us())) {
-    // must be that CLOCK_MONOTONIC is not supported
-    perror("ibmpowernv_poll_sensor: energymon_gettime_us");
-    return (void*) NULL;
+  if ((rc = sensors_get_value(state->cn, state->subfeat_nr, &w))) {
+    fprintf(stderr, "ibmpowernv_poll_sensor: sensors_get_value: %s\n", sensors_strerror(rc));
   }
-  energymon_sleep_us(ENERGYMON_IBMPOWERNV_UPDATE_INTERVAL_US, &state->poll_sensors);
-  while (state->poll_sensors) {
-    if ((rc = sensors_get_value(state->cn, state->subfeat_nr, &w))) {
-      fprintf(stderr, "ibmpowernv_poll_sensor: sensors_get_value: %s\n", sensors_strerror(rc));
-    }
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    if (!rc) {
-      state->total_uj += (uint64_t) (w * (double) exec_us);
-    }
-    // sleep for the update interval of the sensors
-    if (state->poll_sensors) {
-      energymon_sleep_us(ENERGYMON_IBMPOWERNV_UPDATE_INTERVAL_US, &state->poll_sensors);
-    }
+  exec_us = energymon_gettime_elapsed_us(&state->last_us);
+  if (!rc) {
+    state->total_uj += energymon_integrator_add(&state->integ, w * 1000000, exec_us);
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000, (uint64_t) (w * 1000000));
+    energymon_poller_set_interval(&state->task, energymon_poller_adaptive_next(&state->adapt, w * 1000000));
   }
-  return (void*) NULL;
 }
 #endif
 
@@ -221,6 +226,16 @@ int energymon_init_ibmpowernv(energymon* em) {
     return -1;
   }
 
+#ifdef ENERGYMON_IBMPOWERNV_USE_POWER
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_IBMPOWERNV_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_ibmpowernv_power: unknown integration rule: "ENERGYMON_IBMPOWERNV_INTEGRATION"=%s\n",
+            rule_str);
+    return -1;
+  }
+#endif
+
   energymon_ibmpowernv* state = calloc(1, sizeof(energymon_ibmpowernv));
   if (state == NULL) {
     return -1;
@@ -240,11 +255,13 @@ int energymon_init_ibmpowernv(energymon* em) {
 
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
   int err_save;
-  // start sensor polling thread
-  state->poll_sensors = 1;
-  errno = pthread_create(&state->thread, NULL, ibmpowernv_poll_sensor, state);
-  if (errno) {
+  state->extrapolate = getenv(ENERGYMON_IBMPOWERNV_EXTRAPOLATE) != NULL;
+  energymon_integrator_init(&state->integ, rule, ENERGYMON_IBMPOWERNV_UPDATE_INTERVAL_US);
+  if (energymon_poller_adaptive_init(&state->adapt, ENERGYMON_IBMPOWERNV_UPDATE_INTERVAL_US,
+                                     ENERGYMON_IBMPOWERNV_INTERVAL_MIN_US, ENERGYMON_IBMPOWERNV_INTERVAL_MAX_US)) {
     err_save = errno;
+    fprintf(stderr, "energymon_init_ibmpowernv_power: invalid polling interval bounds: "
+            ENERGYMON_IBMPOWERNV_INTERVAL_MIN_US", "ENERGYMON_IBMPOWERNV_INTERVAL_MAX_US"\n");
     close_sensor(state);
     cleanup_libsensors();
     free(state);
@@ -252,6 +269,19 @@ int energymon_init_ibmpowernv(energymon* em) {
     errno = err_save;
     return -1;
   }
+  // start polling the sensors
+  if (!(state->last_us = energymon_gettime_us()) ||
+      energymon_poller_register(&state->task, state->adapt.min_us,
+                                ibmpowernv_poll_sensor, state)) {
+    err_save = errno;
+    close_sensor(state);
+    cleanup_libsensors();
+    free(state);
+    em->state = NULL;
+    errno = err_save;
+    return -1;
+  }
+  state->polling = 1;
 #endif
 
   return 0;
@@ -267,9 +297,13 @@ uint64_t energymon_read_total_ibmpowernv(const energymon* em) {
     return 0;
   }
   errno = 0;
-  const energymon_ibmpowernv* state = (energymon_ibmpowernv*) em->state;
+  energymon_ibmpowernv* state = (energymon_ibmpowernv*) em->state;
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
-  return state->total_uj;
+  if (state->extrapolate) {
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(),
+                                           state->adapt.max_us * 1000);
+  }
+  return energymon_published_energy(&state->pub);
 #else
   // OCC docs say that samples are collected every 250 us, w/ a 4-byte counter (so 2^32 - 1 max samples).
   // So a sensor rollover/reset could occur roughly: 2^32 samples * (1 s / 4000 samples) / 60 / 60 / 24 ~= 12.4 days?
@@ -293,6 +327,18 @@ uint64_t energymon_read_total_ibmpowernv(const energymon* em) {
 #endif
 }
 
+#ifdef ENERGYMON_IBMPOWERNV_USE_POWER
+size_t energymon_read_samples_ibmpowernv_power(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_ibmpowernv* state = (energymon_ibmpowernv*) em->state;
+  return energymon_published_read_samples(&state->pub, state->extrapolate, &state->extrapolated_uj,
+                                          state->adapt.max_us * 1000, samples, n);
+}
+#endif
+
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
 int energymon_finish_ibmpowernv_power(energymon* em) {
 #else
@@ -306,13 +352,11 @@ int energymon_finish_ibmpowernv(energymon* em) {
   int err_save = 0;
   energymon_ibmpowernv* state = (energymon_ibmpowernv*) em->state;
 #ifdef ENERGYMON_IBMPOWERNV_USE_POWER
-  if (state->poll_sensors) {
-    // stop sensors polling thread and cleanup
-    state->poll_sensors = 0;
-#ifndef __ANDROID__
-    pthread_cancel(state->thread);
-#endif
-    err_save = pthread_join(state->thread, NULL);
+  if (state->polling) {
+    // stop polling the sensors and cleanup
+    if (energymon_poller_unregister(&state->task)) {
+      err_save = errno;
+    }
   }
 #endif
   close_sensor(state);
@@ -397,3 +441,9 @@ int energymon_get_ibmpowernv(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+#ifdef ENERGYMON_IBMPOWERNV_USE_POWER
+int energymon_get_ext_ibmpowernv_power(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_ibmpowernv_power);
+}
+#endif
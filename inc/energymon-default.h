@@ -21,6 +21,16 @@ extern "C" {
  */
 int energymon_get_default(energymon* em);
 
+/**
+ * Get the default energymon implementation's extensions.
+ * If the implementation doesn't natively support an extension, a generic
+ * fallback may be used.
+ * Only fails if ext is NULL or its size field is too small.
+ *
+ * @return 0 on success, failure code otherwise
+ */
+int energymon_get_ext_default(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
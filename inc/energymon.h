@@ -126,6 +126,88 @@ struct energymon {
   void* state;
 };
 
+/**
+ * A timestamped energy reading.
+ */
+typedef struct energymon_sample {
+  // monotonic time in nanoseconds at which the energy value was sampled
+  // (for implementations that poll sensors in the background, the time of the poll, not of the read)
+  uint64_t time_ns;
+  // energy (in uJ), as would be returned by energymon_read_total
+  uint64_t energy_uj;
+} energymon_sample;
+
+/**
+ * Read energy samples back-to-back into a caller-supplied array.
+ * Equivalent to calling energymon_read_total n times (and getting the time for
+ * each), but implementations may avoid much of the per-call overhead.
+ *
+ * @param pointer to an energymon
+ * @param pointer to an array of at least n samples
+ * @param the number of samples to read
+ * @return the number of samples read, which is less than n only on failure
+ *         (errno MUST be set)
+ */
+typedef size_t (*energymon_read_samples) (const energymon*, energymon_sample*, size_t);
+
+/**
+ * Maximum length of a channel name, including the null terminator.
+ */
+#define ENERGYMON_CHANNEL_NAME_LEN 64
+
+/**
+ * A named energy reading from one of an implementation's underlying sources,
+ * e.g., a sensor, a power domain, or a processor socket.
+ */
+typedef struct energymon_channel {
+  char name[ENERGYMON_CHANNEL_NAME_LEN];
+  // energy (in uJ) since initialization of the energymon
+  uint64_t energy_uj;
+} energymon_channel;
+
+/**
+ * Read the energy of each channel in a single pass.
+ * Channels are not necessarily disjoint (e.g., a subdomain may be reported in
+ * addition to its parent domain), so their values should not be summed.
+ * The number and order of channels does not change after initialization.
+ *
+ * @param pointer to an energymon
+ * @param pointer to an array of at least n channels
+ * @param the length of the channels array, or 0 to query the channel count
+ * @return the number of channels read (or available, if n is 0), or 0 on
+ *         failure (errno MUST be set), including if n is too small (ENOBUFS)
+ */
+typedef size_t (*energymon_read_channels) (const energymon*, energymon_channel*, size_t);
+
+/**
+ * Optional extensions to an energymon implementation.
+ *
+ * The energymon struct cannot change without breaking the ABI, so additional
+ * functionality is exposed separately.
+ * Implementations that support extensions usually expose a getter function to
+ * populate an energymon_ext struct, similar to populating an energymon struct.
+ * Extension functions operate on the energymon struct from the same
+ * implementation, which must be initialized first.
+ *
+ * Callers must set the size field to sizeof(energymon_ext) before calling a
+ * getter function.
+ * Getters only populate fields that fit within size, so new fields may be
+ * appended in future versions without breaking compatibility with callers
+ * compiled against older versions of this header.
+ * Function pointers for unsupported extensions are set to NULL.
+ */
+typedef struct energymon_ext {
+  size_t size;
+  energymon_read_samples fread_samples;
+  energymon_read_channels fread_channels;
+} energymon_ext;
+
+/**
+ * Check if an energymon_ext struct is large enough to contain a field.
+ */
+#define ENERGYMON_EXT_HAS(ext, field) \
+  ((ext)->size >= offsetof(energymon_ext, field) + sizeof((ext)->field))
+
 #ifdef __cplusplus
 }
 #endif
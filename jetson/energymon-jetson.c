@@ -8,13 +8,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-jetson.h"
+#include "energymon-integrate.h"
+#include "energymon-poller.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #include "energymon-util.h"
 #include "ina3221.h"
@@ -26,6 +29,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_jetson(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_jetson(ext);
+}
 #endif
 
 #define NUM_RAILS_DEFAULT_MAX 6
@@ -46,11 +52,20 @@ int energymon_get_default(energymon* em) {
 typedef struct energymon_jetson {
   // sensor update interval in microseconds
   unsigned long polling_delay_us;
-  // thread variables
-  pthread_t thread;
-  int poll_sensors;
-  // total energy estimate
+  // shared polling thread registration
+  energymon_poller_task task;
+  int polling;
+  uint64_t last_us;
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
+  energymon_integrator integ;
+  // adapts the polling interval to the power signal
+  energymon_poller_adaptive adapt;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // extrapolate reads from the most recent sample, never returning less than extrapolated_uj
+  int extrapolate;
+  uint64_t extrapolated_uj;
   // sensor file descriptors
   // INA3221X provides power (mw) files; INA3221 provides voltage (mv) and current (ma) files
   size_t count;
@@ -162,9 +177,9 @@ static int ina3221x_walk_i2c_drivers_dir_for_default(int* fds, size_t* n_fds, un
 }
 
 /**
- * pthread function to poll the sensor(s) at regular intervals.
+ * Poller function to read the sensor(s) at regular intervals.
  */
-static void* jetson_poll_sensors(void* args) {
+static void jetson_poll_sensors(void* args) {
   energymon_jetson* state = (energymon_jetson*) args;
   char cdata[8];
   char cdata2[8];
@@ -173,46 +188,33 @@ static void* jetson_poll_sensors(void* args) {
   unsigned long ma;
   size_t i;
   uint64_t exec_us;
-  uint64_t last_us;
   int err_save;
-  if (!(last_us = energymon_gettime_us())) {
-    // must be that CLOCK_MONOTONIC is not supported
-    perror("jetson_poll_sensors");
-    return (void*) NULL;
-  }
-  energymon_sleep_us(state->polling_delay_us, &state->poll_sensors);
-  while (state->poll_sensors) {
-    // read individual sensors
-    for (sum_mw = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
-      if (state->fds_mw[i] > 0) {
-        if (pread(state->fds_mw[i], cdata, sizeof(cdata), 0) > 0) {
-          sum_mw += strtoul(cdata, NULL, 0);
-        }
-      } else {
-        if (pread(state->fds_mv[i], cdata, sizeof(cdata), 0) > 0) {
-          if (pread(state->fds_ma[i], cdata2, sizeof(cdata2), 0) > 0) {
-            mv = strtoul(cdata, NULL, 0);
-            ma = strtoul(cdata2, NULL, 0);
-            sum_mw += mv * ma / 1000;
-          }
-        }
+  // read individual sensors
+  for (sum_mw = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
+    if (state->fds_mw[i] > 0) {
+      if (pread(state->fds_mw[i], cdata, sizeof(cdata), 0) > 0) {
+        sum_mw += strtoul(cdata, NULL, 0);
       }
-    }
-    err_save = errno;
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    if (err_save) {
-      errno = err_save;
-      perror("jetson_poll_sensors: skipping power sensor reading");
     } else {
-      state->total_uj += (uint64_t) (sum_mw * exec_us / 1000);
-    }
-    // sleep for the update interval of the sensors
-    if (state->poll_sensors) {
-      energymon_sleep_us(state->polling_delay_us, &state->poll_sensors);
+      if (pread(state->fds_mv[i], cdata, sizeof(cdata), 0) > 0) {
+        if (pread(state->fds_ma[i], cdata2, sizeof(cdata2), 0) > 0) {
+          mv = strtoul(cdata, NULL, 0);
+          ma = strtoul(cdata2, NULL, 0);
+          sum_mw += mv * ma / 1000;
+        }
+      }
     }
-    errno = 0;
   }
-  return (void*) NULL;
+  err_save = errno;
+  exec_us = energymon_gettime_elapsed_us(&state->last_us);
+  if (err_save) {
+    errno = err_save;
+    perror("jetson_poll_sensors: skipping power sensor reading");
+  } else {
+    state->total_uj += energymon_integrator_add(&state->integ, (double) sum_mw * 1000, exec_us);
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000, (uint64_t) sum_mw * 1000);
+    energymon_poller_set_interval(&state->task, energymon_poller_adaptive_next(&state->adapt, (double) sum_mw * 1000));
+  }
 }
 
 // Uses strtok_r to parse the input string into an array (str may be free'd afterward)
@@ -402,6 +404,13 @@ int energymon_init_jetson(energymon* em) {
     return -1;
   }
 
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_JETSON_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_jetson: unknown integration rule: "ENERGYMON_JETSON_INTEGRATION"=%s\n", rule_str);
+    return -1;
+  }
+
   unsigned long polling_delay_us = 0;
   int err_save;
   size_t n_rails;
@@ -456,15 +465,28 @@ int energymon_init_jetson(energymon* em) {
     return -1;
   }
 
-  // start sensors polling thread
-  state->poll_sensors = 1;
-  errno = pthread_create(&state->thread, NULL, jetson_poll_sensors, state);
-  if (errno) {
+  state->extrapolate = getenv(ENERGYMON_JETSON_EXTRAPOLATE) != NULL;
+  energymon_integrator_init(&state->integ, rule, polling_delay_us ? polling_delay_us : state->polling_delay_us);
+
+  if (energymon_poller_adaptive_init(&state->adapt, state->polling_delay_us,
+                                     NULL, ENERGYMON_JETSON_INTERVAL_MAX_US)) {
+    err_save = errno;
+    fprintf(stderr, "energymon_init_jetson: invalid polling interval bounds: "
+            ENERGYMON_JETSON_INTERVAL_MAX_US"\n");
+    energymon_finish_jetson(em);
+    errno = err_save;
+    return -1;
+  }
+
+  // start polling the sensors
+  if (!(state->last_us = energymon_gettime_us()) ||
+      energymon_poller_register(&state->task, state->adapt.min_us, jetson_poll_sensors, state)) {
     err_save = errno;
     energymon_finish_jetson(em);
     errno = err_save;
     return -1;
   }
+  state->polling = 1;
 
   return 0;
 
@@ -501,13 +523,11 @@ int energymon_finish_jetson(energymon* em) {
   int err_save = 0;
   energymon_jetson* state = (energymon_jetson*) em->state;
 
-  if (state->poll_sensors) {
-    // stop sensors polling thread and cleanup
-    state->poll_sensors = 0;
-#ifndef __ANDROID__
-    pthread_cancel(state->thread);
-#endif
-    err_save = pthread_join(state->thread, NULL);
+  if (state->polling) {
+    // stop polling the sensors and cleanup
+    if (energymon_poller_unregister(&state->task)) {
+      err_save = errno;
+    }
   }
 
   // close individual sensor files
@@ -534,8 +554,23 @@ uint64_t energymon_read_total_jetson(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
+  energymon_jetson* state = (energymon_jetson*) em->state;
   errno = 0;
-  return ((energymon_jetson*) em->state)->total_uj;
+  if (state->extrapolate) {
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(),
+                                           state->adapt.max_us * 1000);
+  }
+  return energymon_published_energy(&state->pub);
+}
+
+size_t energymon_read_samples_jetson(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_jetson* state = (energymon_jetson*) em->state;
+  return energymon_published_read_samples(&state->pub, state->extrapolate, &state->extrapolated_uj,
+                                          state->adapt.max_us * 1000, samples, n);
 }
 
 char* energymon_get_source_jetson(char* buffer, size_t n) {
@@ -579,3 +614,7 @@ int energymon_get_jetson(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_jetson(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_jetson);
+}
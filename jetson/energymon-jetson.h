@@ -15,6 +15,23 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to extrapolate energy between samples using the most recent power reading.
+ */
+#define ENERGYMON_JETSON_EXTRAPOLATE "ENERGYMON_JETSON_EXTRAPOLATE"
+
+/*
+ * Environment variable to select the rule for integrating power samples into energy:
+ * "rectangle" (default), "trapezoid", or "window" (the sensor's averaging window).
+ */
+#define ENERGYMON_JETSON_INTEGRATION "ENERGYMON_JETSON_INTEGRATION"
+
+/*
+ * Environment variable to enable adaptive polling: while the power is flat, the polling interval backs off up to this
+ * many microseconds, and returns to the minimum when the power changes.
+ */
+#define ENERGYMON_JETSON_INTERVAL_MAX_US "ENERGYMON_JETSON_INTERVAL_MAX_US"
+
 /*
  * Environment variable for specifying a comma-delimited list of sensor rails to use.
  */
@@ -36,6 +53,10 @@ int energymon_is_exclusive_jetson(void);
 
 int energymon_get_jetson(energymon* em);
 
+size_t energymon_read_samples_jetson(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_jetson(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
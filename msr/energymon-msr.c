@@ -1,25 +1,35 @@
 /**
  * Read energy from X86 MSRs (Model-Specific Registers).
  *
- * By default, the MSR on cpu0 is read. To configure other MSRs, set the
- * ENERGYMON_MSRS environment variable with a comma-delimited list of CPU IDs,
- * e.g.:
+ * By default, the MSR on the first online CPU of each package/die is read, or
+ * on cpu0 if the topology can't be discovered.
+ * To configure other MSRs, set the ENERGYMON_MSRS environment variable with a
+ * comma-delimited list of CPU IDs, e.g.:
  *   export ENERGYMON_MSRS=0,4,8,12
  *
  * @author Connor Imes
  * @author Hank Hoffmann
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-msr.h"
+#include "energymon-poller.h"
+#include "energymon-time-util.h"
 #include "energymon-util.h"
 
 #ifdef ENERGYMON_DEFAULT
@@ -27,11 +37,16 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_msr(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_msr(ext);
+}
 #endif
 
 #define MSR_RAPL_POWER_UNIT		0x606
 
 /* Package RAPL Domain */
+#define MSR_PKG_POWER_INFO		0x614
+
 #define MSR_PKG_ENERGY_STATUS		0x611
 
 /* PP0 RAPL Domain */
@@ -43,18 +58,105 @@ int energymon_get_default(energymon* em) {
 /* DRAM RAPL Domain */
 #define MSR_DRAM_ENERGY_STATUS		0x619
 
+// keep-alive reads happen at this fraction of the time to overflow at TDP
+#ifndef MSR_KEEPALIVE_FRACTION
+  #define MSR_KEEPALIVE_FRACTION 4
+#endif
+// assumed power if TDP isn't reported
+#ifndef MSR_KEEPALIVE_POWER_DEFAULT_W
+  #define MSR_KEEPALIVE_POWER_DEFAULT_W 500.0
+#endif
+
+#define MSR_DOMAINS_DEFAULT "package"
+#define MSR_TOPOLOGY_ROOT_DEFAULT "/sys/devices/system/cpu"
+
+typedef struct msr_domain {
+  const char* name;
+  off_t energy_status;
+} msr_domain;
+
+// domains that can be selected, as a bitmask of their indexes (names match the RAPL sysfs domains)
+static const msr_domain MSR_DOMAINS[] = {
+  { "package", MSR_PKG_ENERGY_STATUS },
+  { "core", MSR_PP0_ENERGY_STATUS },
+  { "uncore", MSR_PP1_ENERGY_STATUS },
+  { "dram", MSR_DRAM_ENERGY_STATUS },
+};
+#define MSR_DOMAINS_LEN (sizeof(MSR_DOMAINS) / sizeof(MSR_DOMAINS[0]))
+#define MSR_DOMAIN_DRAM 3
+
+typedef struct msr_domain_info {
+  // the raw counter value at the last read
+  uint32_t energy_last;
+  // all counter increments since init, including overflows - only converted to microjoules when read
+  uint64_t ticks;
+  // energy units are 1/2^esu Joules
+  unsigned int esu;
+} msr_domain_info;
+
 typedef struct msr_info {
   int fd;
-  unsigned int n_overflow;
-  uint64_t energy_last;
-  double energy_units;
+  unsigned int cpu;
+  // the shortest time for the package counter to overflow, i.e., at TDP
+  uint64_t overflow_us;
+  // indexed like MSR_DOMAINS, only selected domains are used
+  msr_domain_info domains[MSR_DOMAINS_LEN];
 } msr_info;
 
+struct energymon_msr;
+
+// a thread pinned to an MSR's CPU, so reads are local to the package and don't need inter-processor interrupts
+typedef struct msr_reader {
+  pthread_t thread;
+  struct energymon_msr* state;
+  msr_info* m;
+  int err;
+} msr_reader;
+
 typedef struct energymon_msr {
+  // optional pinned readers, one per MSR (NULL if not pinned)
+  msr_reader* readers;
+  unsigned int n_readers;
+  // readers wait for pin_gen to change, and the caller waits for pin_pending to reach 0
+  pthread_mutex_t pin_lock;
+  pthread_cond_t pin_cond;
+  uint64_t pin_gen;
+  unsigned int pin_pending;
+  int pin_stop;
+  // the MSR_DOMAINS indexes of the selected domains
+  unsigned int domains[MSR_DOMAINS_LEN];
+  unsigned int n_domains;
+  // optional keep-alive polling, so counter overflows aren't missed between sparse reads
+  int keepalive;
+  energymon_poller_task task;
+  // serializes reads with the keep-alive poller
+  pthread_mutex_t lock;
   unsigned int msr_count;
   msr_info msrs[];
 } energymon_msr;
 
+// CPU properties that don't change, so are only probed once per process
+typedef struct msr_cpu_cache {
+  char cpu[16];
+  // whether the msr_safe file was used
+  int safe;
+  unsigned int esu;
+  unsigned int dram_esu;
+  uint64_t overflow_us;
+} msr_cpu_cache;
+
+static pthread_mutex_t msr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static msr_cpu_cache* msr_cache = NULL;
+static unsigned int msr_cache_count = 0;
+// discovered CPUs, one per package/die
+static char* msr_cache_cpus = NULL;
+static char msr_cache_root[256];
+
+typedef struct msr_pkg_die {
+  unsigned int pkg;
+  unsigned int die;
+} msr_pkg_die;
+
 /**
  * env_cores is consumed by strtok_r, so cannot be reused after this function.
  */
@@ -69,48 +171,546 @@ static inline unsigned int count_msrs(char* env_cores) {
 }
 
 /**
- * env_cores is consumed by strtok_r, so cannot be reused after this function.
+ * Parse a comma-delimited list of domain names.
+ * Returns 0 on success, -1 on error.
+ */
+static int msr_parse_domains(const char* str, energymon_msr* state) {
+  unsigned int mask = 0;
+  size_t len;
+  unsigned int i;
+  while (*str != '\0') {
+    len = strcspn(str, ",");
+    for (i = 0; i < MSR_DOMAINS_LEN; i++) {
+      if (strlen(MSR_DOMAINS[i].name) == len && strncmp(str, MSR_DOMAINS[i].name, len) == 0) {
+        mask |= 1U << i;
+        break;
+      }
+    }
+    if (i == MSR_DOMAINS_LEN) {
+      fprintf(stderr, "energymon_init_msr: unknown domain in "ENERGYMON_MSR_DOMAINS": %.*s\n", (int) len, str);
+      errno = EINVAL;
+      return -1;
+    }
+    str += len;
+    if (*str == ',') {
+      str++;
+    }
+  }
+  if (mask == 0) {
+    fprintf(stderr, "energymon_init_msr: no domains specified in "ENERGYMON_MSR_DOMAINS"\n");
+    errno = EINVAL;
+    return -1;
+  }
+  for (state->n_domains = 0, i = 0; i < MSR_DOMAINS_LEN; i++) {
+    if (mask & (1U << i)) {
+      state->domains[state->n_domains++] = i;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Read an unsigned integer from a CPU's sysfs topology file.
+ * Returns 0 on success, -1 on error.
+ */
+static int msr_read_topology(const char* root, unsigned int cpu, const char* file, unsigned int* val) {
+  char path[320];
+  char buf[24];
+  uint64_t v;
+  ssize_t ret;
+  int err_save;
+  int fd;
+  snprintf(path, sizeof(path), "%s/cpu%u/topology/%s", root, cpu, file);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  ret = pread(fd, buf, sizeof(buf), 0);
+  err_save = errno;
+  close(fd);
+  errno = err_save;
+  if (ret < 0) {
+    return -1;
+  }
+  // e.g., physical_package_id is -1 if unknown
+  if (energymon_parse_u64(buf, (size_t) ret, &v) || v > UINT32_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  *val = (unsigned int) v;
+  return 0;
+}
+
+/**
+ * Find the first online CPU in each package/die, using sysfs topology.
+ * Returns a comma-delimited list of CPUs (must be freed), or NULL on error.
+ */
+static char* msr_discover_cpus(const char* root) {
+  char online[4096];
+  char path[320];
+  msr_pkg_die* pds = NULL;
+  msr_pkg_die* tmp;
+  char* tmp_list;
+  unsigned int n_pds = 0;
+  unsigned long first;
+  unsigned long last;
+  unsigned long cpu;
+  msr_pkg_die pd;
+  unsigned int i;
+  const char* p;
+  char* end;
+  char* list = NULL;
+  size_t len = 0;
+  ssize_t ret;
+  int err_save;
+  int fd;
+  snprintf(path, sizeof(path), "%s/online", root);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return NULL;
+  }
+  ret = pread(fd, online, sizeof(online) - 1, 0);
+  err_save = errno;
+  close(fd);
+  errno = err_save;
+  if (ret < 0) {
+    return NULL;
+  }
+  online[ret] = '\0';
+  // the list of ranges is formatted like: 0-3,8,10-11
+  for (p = online; *p != '\0' && *p != '\n'; p = *end == ',' ? end + 1 : end) {
+    first = strtoul(p, &end, 10);
+    last = first;
+    if (end != p && *end == '-') {
+      p = end + 1;
+      last = strtoul(p, &end, 10);
+    }
+    if (end == p || last < first || (*end != ',' && *end != '\n' && *end != '\0')) {
+      errno = EINVAL;
+      goto fail;
+    }
+    for (cpu = first; cpu <= last; cpu++) {
+      if (msr_read_topology(root, (unsigned int) cpu, "physical_package_id", &pd.pkg)) {
+        goto fail;
+      }
+      // die_id was added in Linux 5.2
+      if (msr_read_topology(root, (unsigned int) cpu, "die_id", &pd.die)) {
+        if (errno != ENOENT) {
+          goto fail;
+        }
+        pd.die = 0;
+      }
+      for (i = 0; i < n_pds && (pds[i].pkg != pd.pkg || pds[i].die != pd.die); i++);
+      if (i < n_pds) {
+        continue;
+      }
+      // inefficient to realloc every iteration, but straightforward
+      if ((tmp = realloc(pds, (n_pds + 1) * sizeof(msr_pkg_die))) == NULL) {
+        goto fail;
+      }
+      pds = tmp;
+      if ((tmp_list = realloc(list, len + 12)) == NULL) {
+        goto fail;
+      }
+      list = tmp_list;
+      pds[n_pds++] = pd;
+      len += (size_t) snprintf(list + len, 12, "%s%lu", len > 0 ? "," : "", cpu);
+    }
+  }
+  free(pds);
+  if (list == NULL) {
+    errno = ENODEV;
+  }
+  return list;
+
+fail:
+  err_save = errno;
+  free(pds);
+  free(list);
+  errno = err_save;
+  return NULL;
+}
+
+/**
+ * Get a copy of the discovered CPUs, only discovering them if not already cached.
+ * Returns a comma-delimited list of CPUs (must be freed), or NULL on error.
+ */
+static char* msr_discover_cpus_cached(const char* root) {
+  char* cpus = NULL;
+  pthread_mutex_lock(&msr_cache_lock);
+  if (msr_cache_cpus == NULL || strcmp(root, msr_cache_root) != 0) {
+    free(msr_cache_cpus);
+    if ((msr_cache_cpus = msr_discover_cpus(root)) != NULL) {
+      energymon_strencpy(msr_cache_root, root, sizeof(msr_cache_root));
+    }
+  }
+  if (msr_cache_cpus != NULL) {
+    cpus = strdup(msr_cache_cpus);
+  }
+  pthread_mutex_unlock(&msr_cache_lock);
+  return cpus;
+}
+
+/**
+ * Server processors use a fixed DRAM energy unit of 2^-16 J (15.3 uJ), rather than the energy status units.
+ */
+static int msr_has_fixed_dram_units(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || ((eax >> 8) & 0xf) != 6) {
+    return 0;
+  }
+  switch (((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0)) {
+    case 0x3F: // Haswell-E
+    case 0x4F: // Broadwell-E
+    case 0x56: // Broadwell-DE
+    case 0x55: // Skylake-SP, Cascade Lake, Cooper Lake
+    case 0x57: // Knights Landing
+    case 0x85: // Knights Mill
+    case 0x6A: // Ice Lake-SP
+    case 0x6C: // Ice Lake-D
+    case 0x8F: // Sapphire Rapids
+    case 0xCF: // Emerald Rapids
+    case 0xAD: // Granite Rapids
+    case 0xAE: // Granite Rapids-D
+      return 1;
+    default:
+      break;
+  }
+#endif
+  return 0;
+}
+
+static void msr_set_units(msr_info* m, unsigned int esu, unsigned int dram_esu) {
+  unsigned int i;
+  for (i = 0; i < MSR_DOMAINS_LEN; i++) {
+    m->domains[i].energy_last = 0;
+    m->domains[i].ticks = 0;
+    m->domains[i].esu = i == MSR_DOMAIN_DRAM ? dram_esu : esu;
+  }
+}
+
+/**
+ * Returns the cached properties for a CPU, or NULL if not found.
+ */
+static msr_cpu_cache* msr_cache_find(const char* cpu) {
+  unsigned int i;
+  for (i = 0; i < msr_cache_count; i++) {
+    if (strcmp(msr_cache[i].cpu, cpu) == 0) {
+      return &msr_cache[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Cache a CPU's properties - failure isn't an error, it only means they'll be probed again next time.
+ */
+static void msr_cache_put(msr_cpu_cache* c, const char* cpu, int safe, const msr_info* m) {
+  msr_cpu_cache* tmp;
+  if (c == NULL) {
+    if (strlen(cpu) >= sizeof(c->cpu) ||
+        (tmp = realloc(msr_cache, (msr_cache_count + 1) * sizeof(msr_cpu_cache))) == NULL) {
+      return;
+    }
+    msr_cache = tmp;
+    c = &msr_cache[msr_cache_count++];
+    energymon_strencpy(c->cpu, cpu, sizeof(c->cpu));
+  }
+  c->safe = safe;
+  c->esu = m->domains[0].esu;
+  c->dram_esu = m->domains[MSR_DOMAIN_DRAM].esu;
+  c->overflow_us = m->overflow_us;
+}
+
+/**
+ * Open a CPU's MSR file and get its properties, only probing the MSRs if they aren't already cached.
+ * Must hold msr_cache_lock.
  * Returns the errno (if any)
  */
-static inline int msr_info_init(msr_info* m, unsigned int n, char* env_cores) {
+static int msr_info_init_cpu(msr_info* m, const char* cpu) {
   uint64_t msr_val;
-  unsigned int i;
   unsigned int energy_status_units;
+  double power_units;
+  double tdp;
+  int safe = 1;
   char filename[32];
-  char* saveptr;
-  const char* tok = env_cores == NULL ? "0" :
-    strtok_r(env_cores, ENERGYMON_MSRS_DELIMS, &saveptr);
-  for (i = 0; tok && i < n; i++) {
-    m[i].n_overflow = 0;
-    m[i].energy_last = 0;
-    // first try msr_safe file
-    snprintf(filename, sizeof(filename), "/dev/cpu/%s/msr_safe", tok);
-    if ((m[i].fd = open(filename, O_RDONLY)) <= 0) {
-      // fall back on regular msr file
-      snprintf(filename, sizeof(filename), "/dev/cpu/%s/msr", tok);
-      if ((m[i].fd = open(filename, O_RDONLY)) <= 0) {
-        perror(filename);
-        return errno;
-      }
+  msr_cpu_cache* c = msr_cache_find(cpu);
+  if (c != NULL) {
+    snprintf(filename, sizeof(filename), "/dev/cpu/%s/%s", cpu, c->safe ? "msr_safe" : "msr");
+    if ((m->fd = open(filename, O_RDONLY)) > 0) {
+      msr_set_units(m, c->esu, c->dram_esu);
+      m->overflow_us = c->overflow_us;
+      return 0;
     }
-    if (pread(m[i].fd, &msr_val, sizeof(msr_val), MSR_RAPL_POWER_UNIT) < 0) {
+    // e.g., if a module was unloaded, so probe again
+  }
+  // first try msr_safe file
+  snprintf(filename, sizeof(filename), "/dev/cpu/%s/msr_safe", cpu);
+  if ((m->fd = open(filename, O_RDONLY)) <= 0) {
+    // fall back on regular msr file
+    safe = 0;
+    snprintf(filename, sizeof(filename), "/dev/cpu/%s/msr", cpu);
+    if ((m->fd = open(filename, O_RDONLY)) <= 0) {
       perror(filename);
       return errno;
     }
+  }
+  if (pread(m->fd, &msr_val, sizeof(msr_val), MSR_RAPL_POWER_UNIT) < 0) {
+    perror(filename);
+    return errno;
+  }
 
-    // Energy related information (in Joules) is based on the multiplier,
-    // 1/2^ESU; where ESU is an unsigned integer represented by bits 12:8.
-    energy_status_units = ((msr_val >> 8) & 0x1f);
-    // At 5 bits only, 0 <= energy_status_units < 32, so bit shift instead,
-    // no need to use "pow" and require linking to math library
-    // m[i].energy_units = pow(0.5, energy_status_units);
-    m[i].energy_units = 1.0 / (1 << energy_status_units);
+  // Energy related information (in Joules) is based on the multiplier,
+  // 1/2^ESU; where ESU is an unsigned integer represented by bits 12:8.
+  energy_status_units = ((msr_val >> 8) & 0x1f);
+  // Units are a power of two, so counts are converted with shifts instead of floating point math
+  msr_set_units(m, energy_status_units, msr_has_fixed_dram_units() ? 16 : energy_status_units);
+  // Power units are 1/2^PU Watts, where PU is bits 3:0.
+  power_units = 1.0 / (1 << (msr_val & 0xf));
+
+  // TDP is bits 14:0 of the package power info - it's only for computing a keep-alive interval, so use a
+  // conservative default if it's not available
+  if (pread(m->fd, &msr_val, sizeof(msr_val), MSR_PKG_POWER_INFO) != sizeof(msr_val) ||
+      (tdp = (double) (msr_val & 0x7fff) * power_units) <= 0) {
+    tdp = MSR_KEEPALIVE_POWER_DEFAULT_W;
+  }
+  m->overflow_us = (uint64_t) ((double) (((uint64_t) 1 << 32) >> energy_status_units) / tdp * 1000000.0);
+  msr_cache_put(c, cpu, safe, m);
+  return 0;
+}
+
+/**
+ * env_cores is consumed by strtok_r, so cannot be reused after this function.
+ * Returns the errno (if any)
+ */
+static inline int msr_info_init(msr_info* m, unsigned int n, char* env_cores) {
+  unsigned int i;
+  int err = 0;
+  char* saveptr;
+  const char* tok = env_cores == NULL ? "0" :
+    strtok_r(env_cores, ENERGYMON_MSRS_DELIMS, &saveptr);
+  pthread_mutex_lock(&msr_cache_lock);
+  for (i = 0; tok && i < n && !err; i++) {
+    m[i].cpu = (unsigned int) strtoul(tok, NULL, 10);
+    err = msr_info_init_cpu(&m[i], tok);
     tok = env_cores == NULL ? NULL :
       strtok_r(NULL, ENERGYMON_MSRS_DELIMS, &saveptr);
   }
+  pthread_mutex_unlock(&msr_cache_lock);
+  return err;
+}
+
+/**
+ * Exact conversion (rounded down) that can't overflow, unlike multiplying all ticks by 1000000 before shifting.
+ */
+static inline uint64_t msr_ticks_to_uj(uint64_t ticks, unsigned int esu) {
+  return (ticks >> esu) * 1000000 + (((ticks & (((uint64_t) 1 << esu) - 1)) * 1000000) >> esu);
+}
+
+/**
+ * Read the selected domains for an MSR.
+ * Returns 0 on success, -1 on error.
+ */
+static int msr_read_one(const energymon_msr* state, msr_info* m) {
+  msr_domain_info* d;
+  unsigned int j;
+  uint64_t msr_val;
+  ssize_t ret;
+  for (j = 0; j < state->n_domains; j++) {
+    d = &m->domains[state->domains[j]];
+    if ((ret = pread(m->fd, &msr_val, sizeof(uint64_t), MSR_DOMAINS[state->domains[j]].energy_status))
+        != sizeof(uint64_t)) {
+      if (ret >= 0) {
+        errno = EIO;
+      }
+      return -1;
+    }
+    // bits 31:0 hold the energy consumption counter, ignore upper 32 bits - unsigned subtraction handles overflow
+    d->ticks += (uint32_t) ((uint32_t) msr_val - d->energy_last);
+    d->energy_last = (uint32_t) msr_val;
+  }
+  return 0;
+}
+
+static void* msr_reader_run(void* arg) {
+  msr_reader* r = (msr_reader*) arg;
+  energymon_msr* state = r->state;
+  uint64_t gen = 0;
+  pthread_mutex_lock(&state->pin_lock);
+  while (1) {
+    while (state->pin_gen == gen && !state->pin_stop) {
+      pthread_cond_wait(&state->pin_cond, &state->pin_lock);
+    }
+    if (state->pin_stop) {
+      break;
+    }
+    gen = state->pin_gen;
+    pthread_mutex_unlock(&state->pin_lock);
+    r->err = msr_read_one(state, r->m) ? errno : 0;
+    pthread_mutex_lock(&state->pin_lock);
+    if (--state->pin_pending == 0) {
+      pthread_cond_broadcast(&state->pin_cond);
+    }
+  }
+  pthread_mutex_unlock(&state->pin_lock);
+  return NULL;
+}
+
+/**
+ * Have the pinned readers read their MSRs concurrently, and wait for them to finish.
+ * Returns 0 on success, -1 on error.
+ */
+static int msr_read_pinned(energymon_msr* state) {
+  unsigned int i;
+  pthread_mutex_lock(&state->pin_lock);
+  state->pin_gen++;
+  state->pin_pending = state->n_readers;
+  pthread_cond_broadcast(&state->pin_cond);
+  while (state->pin_pending > 0) {
+    pthread_cond_wait(&state->pin_cond, &state->pin_lock);
+  }
+  pthread_mutex_unlock(&state->pin_lock);
+  for (i = 0; i < state->n_readers; i++) {
+    if (state->readers[i].err) {
+      errno = state->readers[i].err;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void msr_stop_readers(energymon_msr* state) {
+  unsigned int i;
+  pthread_mutex_lock(&state->pin_lock);
+  state->pin_stop = 1;
+  pthread_cond_broadcast(&state->pin_cond);
+  pthread_mutex_unlock(&state->pin_lock);
+  for (i = 0; i < state->n_readers; i++) {
+    pthread_join(state->readers[i].thread, NULL);
+  }
+  state->n_readers = 0;
+  free(state->readers);
+  state->readers = NULL;
+}
+
+/**
+ * Start a reader thread pinned to each MSR's CPU.
+ * Returns 0 on success, -1 on error.
+ */
+static int msr_start_readers(energymon_msr* state) {
+  pthread_attr_t attr;
+  cpu_set_t set;
+  unsigned int i;
+  int err = 0;
+  if ((state->readers = calloc(state->msr_count, sizeof(msr_reader))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < state->msr_count && !err; i++) {
+    state->readers[i].state = state;
+    state->readers[i].m = &state->msrs[i];
+    if (state->msrs[i].cpu >= CPU_SETSIZE) {
+      err = EINVAL;
+      break;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(state->msrs[i].cpu, &set);
+    if (!(err = pthread_attr_init(&attr))) {
+      if (!(err = pthread_attr_setaffinity_np(&attr, sizeof(set), &set)) &&
+          !(err = pthread_create(&state->readers[i].thread, &attr, msr_reader_run, &state->readers[i]))) {
+        state->n_readers++;
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+  if (err) {
+    msr_stop_readers(state);
+    errno = err;
+    return -1;
+  }
   return 0;
 }
 
+/**
+ * Read the selected domains for all MSRs in one pass, adding each domain's energy to totals (in selection order).
+ * Returns 0 on success, -1 on error.
+ */
+static inline int msr_read_domains(energymon_msr* state, uint64_t* totals) {
+  const msr_domain_info* d;
+  unsigned int i;
+  unsigned int j;
+  if (state->readers != NULL) {
+    if (msr_read_pinned(state)) {
+      return -1;
+    }
+  } else {
+    for (i = 0; i < state->msr_count; i++) {
+      if (msr_read_one(state, &state->msrs[i])) {
+        return -1;
+      }
+    }
+  }
+  for (i = 0; i < state->msr_count; i++) {
+    for (j = 0; j < state->n_domains; j++) {
+      d = &state->msrs[i].domains[state->domains[j]];
+      totals[j] += msr_ticks_to_uj(d->ticks, d->esu);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Returns 0 on error (check errno), otherwise the total energy across MSRs and domains.
+ */
+static inline uint64_t msr_read_total(energymon_msr* state) {
+  uint64_t totals[MSR_DOMAINS_LEN] = { 0 };
+  uint64_t total = 0;
+  unsigned int j;
+  errno = 0;
+  if (msr_read_domains(state, totals)) {
+    return 0;
+  }
+  for (j = 0; j < state->n_domains; j++) {
+    total += totals[j];
+  }
+  return total;
+}
+
+/**
+ * A fraction of the shortest time for any counter to overflow.
+ */
+static uint64_t msr_keepalive_interval_us(const energymon_msr* state) {
+  uint64_t interval_us = UINT64_MAX;
+  unsigned int i;
+  for (i = 0; i < state->msr_count; i++) {
+    if (state->msrs[i].overflow_us / MSR_KEEPALIVE_FRACTION < interval_us) {
+      interval_us = state->msrs[i].overflow_us / MSR_KEEPALIVE_FRACTION;
+    }
+  }
+  return interval_us < 1000 ? 1000 : interval_us;
+}
+
+/**
+ * Called from the polling thread to read all MSRs often enough that no overflow is missed.
+ */
+static void msr_keepalive(void* arg) {
+  energymon_msr* state = (energymon_msr*) arg;
+  pthread_mutex_lock(&state->lock);
+  // errors are reported by the next (non-keep-alive) read
+  msr_read_total(state);
+  pthread_mutex_unlock(&state->lock);
+}
+
+static inline uint64_t msr_read_total_locked(energymon_msr* state) {
+  uint64_t total;
+  if (state->keepalive) {
+    pthread_mutex_lock(&state->lock);
+  }
+  total = msr_read_total(state);
+  if (state->keepalive) {
+    pthread_mutex_unlock(&state->lock);
+  }
+  return total;
+}
+
 int energymon_init_msr(energymon* em) {
   if (em == NULL || em->state != NULL) {
     errno = EINVAL;
@@ -119,20 +719,49 @@ int energymon_init_msr(energymon* em) {
 
   unsigned int ncores = 1;
   char* tmp = NULL;
+  const char* keepalive_str = getenv(ENERGYMON_MSR_KEEPALIVE);
+  const char* domains_str = getenv(ENERGYMON_MSR_DOMAINS);
+  uint64_t keepalive_us = 0;
+  // an empty value (or 0) uses the computed interval
+  if (keepalive_str != NULL && *keepalive_str != '\0' && energymon_parse_u64(keepalive_str, strlen(keepalive_str),
+                                                                              &keepalive_us)) {
+    fprintf(stderr, "energymon_init_msr: invalid keep-alive interval: "ENERGYMON_MSR_KEEPALIVE"=%s\n",
+            keepalive_str);
+    errno = EINVAL;
+    return -1;
+  }
   // get a delimited list of cores with MSRs to read from
   const char* env_cores = getenv(ENERGYMON_MSR_ENV_VAR);
+  const char* root = getenv(ENERGYMON_MSR_TOPOLOGY_ROOT);
+  char* discovered = NULL;
+  int save_err;
+  if (env_cores == NULL) {
+    if ((discovered = msr_discover_cpus_cached(root == NULL ? MSR_TOPOLOGY_ROOT_DEFAULT : root)) != NULL) {
+      env_cores = discovered;
+    } else if (root != NULL) {
+      save_err = errno;
+      perror("energymon_init_msr: Failed to discover CPU topology from "ENERGYMON_MSR_TOPOLOGY_ROOT);
+      errno = save_err;
+      return -1;
+    }
+    // otherwise, e.g., if sysfs isn't available, fall back on cpu 0
+  }
   if (env_cores != NULL) {
     if ((tmp = strdup(env_cores)) == NULL) {
+      free(discovered);
       return -1;
     }
     ncores = count_msrs(tmp);
     free(tmp);
     if (ncores == 0) {
+      free(discovered);
       errno = EINVAL;
       perror("Parsing number of cores from " ENERGYMON_MSR_ENV_VAR " env var");
       return -1;
     }
-    if ((tmp = strdup(env_cores)) == NULL) {
+    tmp = strdup(env_cores);
+    free(discovered);
+    if (tmp == NULL) {
       return -1;
     }
   }
@@ -144,10 +773,18 @@ int energymon_init_msr(energymon* em) {
     return -1;
   }
   state->msr_count = ncores;
+  if (msr_parse_domains(domains_str == NULL ? MSR_DOMAINS_DEFAULT : domains_str, state)) {
+    free(tmp);
+    free(state);
+    return -1;
+  }
+  pthread_mutex_init(&state->lock, NULL);
+  pthread_mutex_init(&state->pin_lock, NULL);
+  pthread_cond_init(&state->pin_cond, NULL);
 
   // open the MSR files
   em->state = state;
-  int save_err = msr_info_init(state->msrs, ncores, tmp);
+  save_err = msr_info_init(state->msrs, ncores, tmp);
   free(tmp);
   if (save_err) {
     energymon_finish_msr(em);
@@ -155,6 +792,28 @@ int energymon_init_msr(energymon* em) {
     return -1;
   }
 
+  if (getenv(ENERGYMON_MSR_PIN) != NULL && msr_start_readers(state)) {
+    save_err = errno;
+    perror("energymon_init_msr: Failed to start pinned readers");
+    energymon_finish_msr(em);
+    errno = save_err;
+    return -1;
+  }
+
+  if (keepalive_str != NULL) {
+    if (keepalive_us == 0) {
+      keepalive_us = msr_keepalive_interval_us(state);
+    }
+    if (energymon_poller_register(&state->task, keepalive_us, &msr_keepalive, state)) {
+      save_err = errno;
+      perror("energymon_init_msr: Failed to start keep-alive polling");
+      energymon_finish_msr(em);
+      errno = save_err;
+      return -1;
+    }
+    state->keepalive = 1;
+  }
+
   return 0;
 }
 
@@ -163,26 +822,58 @@ uint64_t energymon_read_total_msr(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
+  return msr_read_total_locked((energymon_msr*) em->state);
+}
 
-  unsigned int i;
-  uint64_t msr_val;
-  uint64_t total = 0;
+size_t energymon_read_samples_msr(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
   energymon_msr* state = (energymon_msr*) em->state;
-  for (errno = 0, i = 0; i < state->msr_count && !errno; i++) {
-    if (pread(state->msrs[i].fd, &msr_val, sizeof(uint64_t),
-              MSR_PKG_ENERGY_STATUS) == sizeof(uint64_t)) {
-      // bits 31:0 hold the energy consumption counter, ignore upper 32 bits
-      msr_val &= 0xFFFFFFFF;
-      // overflows at 32 bits
-      if (msr_val < state->msrs[i].energy_last) {
-        state->msrs[i].n_overflow++;
-      }
-      state->msrs[i].energy_last = msr_val;
-      total += (uint64_t) ((double) (msr_val + state->msrs[i].n_overflow * (uint64_t) UINT32_MAX)
-                           * state->msrs[i].energy_units * 1000000.0);
+  size_t i;
+  for (i = 0; i < n; i++) {
+    samples[i].time_ns = energymon_gettime_ns();
+    samples[i].energy_uj = msr_read_total_locked(state);
+    if (samples[i].energy_uj == 0 && errno) {
+      break;
     }
   }
-  return errno ? 0 : total;
+  return i;
+}
+
+size_t energymon_read_channels_msr(const energymon* em, energymon_channel* channels, size_t n) {
+  if (em == NULL || em->state == NULL || (channels == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_msr* state = (energymon_msr*) em->state;
+  uint64_t totals[MSR_DOMAINS_LEN] = { 0 };
+  unsigned int j;
+  int ret;
+  if (n == 0) {
+    return state->n_domains;
+  }
+  if (n < state->n_domains) {
+    errno = ENOBUFS;
+    return 0;
+  }
+  errno = 0;
+  if (state->keepalive) {
+    pthread_mutex_lock(&state->lock);
+  }
+  ret = msr_read_domains(state, totals);
+  if (state->keepalive) {
+    pthread_mutex_unlock(&state->lock);
+  }
+  if (ret) {
+    return 0;
+  }
+  for (j = 0; j < state->n_domains; j++) {
+    channels[j].energy_uj = totals[j];
+    energymon_strencpy(channels[j].name, MSR_DOMAINS[state->domains[j]].name, sizeof(channels[j].name));
+  }
+  return state->n_domains;
 }
 
 int energymon_finish_msr(energymon* em) {
@@ -194,11 +885,20 @@ int energymon_finish_msr(energymon* em) {
   int err_save = 0;
   unsigned int i;
   energymon_msr* state = em->state;
+  if (state->keepalive && energymon_poller_unregister(&state->task)) {
+    err_save = errno;
+  }
+  if (state->readers != NULL) {
+    msr_stop_readers(state);
+  }
   for (i = 0; i < state->msr_count; i++) {
     if (state->msrs[i].fd > 0 && close(state->msrs[i].fd)) {
       err_save = errno;
     }
   }
+  pthread_cond_destroy(&state->pin_cond);
+  pthread_mutex_destroy(&state->pin_lock);
+  pthread_mutex_destroy(&state->lock);
   free(em->state);
   em->state = NULL;
   errno = err_save;
@@ -224,15 +924,18 @@ uint64_t energymon_get_precision_msr(const energymon* em) {
     return 0;
   }
   energymon_msr* state = (energymon_msr*) em->state;
-  double units = 0;
+  unsigned int esu = 32;
   unsigned int i;
+  unsigned int j;
   for (i = 0; i < state->msr_count; i++) {
-    // precision limited by the largest units (they should all be the same though)
-    if (state->msrs[i].energy_units > units) {
-      units = state->msrs[i].energy_units;
+    for (j = 0; j < state->n_domains; j++) {
+      // precision limited by the largest units (they should all be the same, except maybe DRAM)
+      if (state->msrs[i].domains[state->domains[j]].esu < esu) {
+        esu = state->msrs[i].domains[state->domains[j]].esu;
+      }
     }
   }
-  return (uint64_t) (units * 1000000);
+  return msr_ticks_to_uj(1, esu);
 }
 
 int energymon_is_exclusive_msr(void) {
@@ -254,3 +957,16 @@ int energymon_get_msr(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_msr(energymon_ext* ext) {
+  if (energymon_ext_clear(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_samples)) {
+    ext->fread_samples = &energymon_read_samples_msr;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_channels)) {
+    ext->fread_channels = &energymon_read_channels_msr;
+  }
+  return 0;
+}
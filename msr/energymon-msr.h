@@ -1,9 +1,10 @@
 /**
  * Read energy from X86 MSRs (Model-Specific Registers).
  *
- * By default, the MSR on cpu0 is read. To configure other MSRs, set the
- * ENERGYMON_MSRS environment variable with a comma-delimited list of CPU IDs,
- * e.g.:
+ * By default, the MSR on the first online CPU of each package/die is read, or
+ * on cpu0 if the topology can't be discovered.
+ * To configure other MSRs, set the ENERGYMON_MSRS environment variable with a
+ * comma-delimited list of CPU IDs, e.g.:
  *   export ENERGYMON_MSRS=0,4,8,12
  *
  * @author Hank Hoffmann
@@ -20,10 +21,40 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
-/* Environment variable for specifying the MSRs to use */
+/*
+ * Environment variable for specifying the MSRs to use.
+ * By default, the first online CPU in each package/die is used, as discovered from sysfs topology.
+ */
 #define ENERGYMON_MSR_ENV_VAR "ENERGYMON_MSRS"
 #define ENERGYMON_MSRS_DELIMS ", :;|"
 
+/*
+ * Environment variable to override the sysfs CPU directory used for topology discovery
+ * (default: "/sys/devices/system/cpu"), e.g., for testing.
+ */
+#define ENERGYMON_MSR_TOPOLOGY_ROOT "ENERGYMON_MSR_TOPOLOGY_ROOT"
+
+/*
+ * Environment variable to read each MSR from a thread pinned to its CPU (any value), so reads don't need
+ * inter-processor interrupts to other packages.
+ */
+#define ENERGYMON_MSR_PIN "ENERGYMON_MSR_PIN"
+
+/*
+ * Environment variable to enable a background keep-alive that reads the MSRs often enough that no counter overflow is
+ * missed, even if the application reads rarely.
+ * If set to a positive integer, it's the keep-alive interval in microseconds.
+ * Otherwise (e.g., empty or 0), the interval is a fraction of the shortest time for a counter to overflow at TDP.
+ */
+#define ENERGYMON_MSR_KEEPALIVE "ENERGYMON_MSR_KEEPALIVE"
+
+/*
+ * Environment variable for specifying a comma-delimited list of domains to read:
+ * "package" (default), "core" (PP0), "uncore" (PP1), and/or "dram".
+ * The total is the sum across domains, and each domain's total is reported as a channel.
+ */
+#define ENERGYMON_MSR_DOMAINS "ENERGYMON_MSR_DOMAINS"
+
 int energymon_init_msr(energymon* em);
 
 uint64_t energymon_read_total_msr(const energymon* em);
@@ -40,6 +71,12 @@ int energymon_is_exclusive_msr(void);
 
 int energymon_get_msr(energymon* em);
 
+size_t energymon_read_samples_msr(const energymon* em, energymon_sample* samples, size_t n);
+
+size_t energymon_read_channels_msr(const energymon* em, energymon_channel* channels, size_t n);
+
+int energymon_get_ext_msr(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
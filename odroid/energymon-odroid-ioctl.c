@@ -9,14 +9,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-odroid-ioctl.h"
+#include "energymon-integrate.h"
+#include "energymon-poller.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #include "energymon-util.h"
 
@@ -25,6 +28,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_odroid_ioctl(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_odroid_ioctl(ext);
+}
 #endif
 
 #define SENSOR_POLL_DELAY_US_DEFAULT 263808
@@ -63,11 +69,20 @@ typedef struct energymon_odroid_ioctl {
   ina231_sensor_t sensor[SENSOR_COUNT];
   // sensor update interval in microseconds
   unsigned long poll_delay_us;
-  // total energy estimate
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
-  // thread variables
-  pthread_t thread;
-  int poll_sensors;
+  energymon_integrator integ;
+  // adapts the polling interval to the power signal
+  energymon_poller_adaptive adapt;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // extrapolate reads from the most recent sample, never returning less than extrapolated_uj
+  int extrapolate;
+  uint64_t extrapolated_uj;
+  // shared polling thread registration
+  energymon_poller_task task;
+  int polling;
+  uint64_t last_us;
 } energymon_odroid_ioctl;
 
 static inline int set_sensor_enable(ina231_sensor_t* sensor, int enable) {
@@ -130,13 +145,11 @@ int energymon_finish_odroid_ioctl(energymon* em) {
 
   int err_save = 0;
   energymon_odroid_ioctl* state = (energymon_odroid_ioctl*) em->state;
-  if (state->poll_sensors) {
-    // stop sensors polling thread and cleanup
-    state->poll_sensors = 0;
-#ifndef __ANDROID__
-    pthread_cancel(state->thread);
-#endif
-    err_save = pthread_join(state->thread, NULL);
+  if (state->polling) {
+    // stop polling the sensors and cleanup
+    if (energymon_poller_unregister(&state->task)) {
+      err_save = errno;
+    }
   }
   if (close_all_sensors(state)) {
     err_save = err_save ? err_save : errno;
@@ -148,43 +161,30 @@ int energymon_finish_odroid_ioctl(energymon* em) {
 }
 
 /**
- * pthread function to poll the sensors at regular intervals.
+ * Poller function to read the sensors at regular intervals.
  */
-static void* odroid_ioctl_poll_sensors(void* args) {
+static void odroid_ioctl_poll_sensors(void* args) {
   energymon_odroid_ioctl* state = (energymon_odroid_ioctl*) args;
   uint64_t sum_uw;
   unsigned int i;
   uint64_t exec_us;
-  uint64_t last_us;
   int err_save;
-  if (!(last_us = energymon_gettime_us())) {
-    // must be that CLOCK_MONOTONIC is not supported
-    perror("odroid_ioctl_poll_sensors");
-    return (void*) NULL;
-  }
-  energymon_sleep_us(state->poll_delay_us, &state->poll_sensors);
-  while (state->poll_sensors) {
-    // read individual sensors
-    for (errno = 0, sum_uw = 0, i = 0; i < SENSOR_COUNT && !errno; i++) {
-      if (!read_sensor_data(&state->sensor[i])) {
-        sum_uw += state->sensor[i].data.cur_uW;
-      }
-    }
-    err_save = errno;
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    if (err_save) {
-      errno = err_save;
-      perror("odroid_ioctl_poll_sensors: skipping power sensor reading");
-    } else {
-      state->total_uj += sum_uw * exec_us / 1000000;
+  // read individual sensors
+  for (errno = 0, sum_uw = 0, i = 0; i < SENSOR_COUNT && !errno; i++) {
+    if (!read_sensor_data(&state->sensor[i])) {
+      sum_uw += state->sensor[i].data.cur_uW;
     }
-    // sleep for the update interval of the sensors
-    if (state->poll_sensors) {
-      energymon_sleep_us(state->poll_delay_us, &state->poll_sensors);
-    }
-    errno = 0;
   }
-  return (void*) NULL;
+  err_save = errno;
+  exec_us = energymon_gettime_elapsed_us(&state->last_us);
+  if (err_save) {
+    errno = err_save;
+    perror("odroid_ioctl_poll_sensors: skipping power sensor reading");
+  } else {
+    state->total_uj += energymon_integrator_add(&state->integ, (double) sum_uw, exec_us);
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000, sum_uw);
+    energymon_poller_set_interval(&state->task, energymon_poller_adaptive_next(&state->adapt, (double) sum_uw));
+  }
 }
 
 /**
@@ -196,6 +196,13 @@ int energymon_init_odroid_ioctl(energymon* em) {
     return -1;
   }
 
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_ODROID_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_odroid_ioctl: unknown integration rule: "ENERGYMON_ODROID_INTEGRATION"=%s\n", rule_str);
+    return -1;
+  }
+
   int err_save;
   energymon_odroid_ioctl* state = calloc(1, sizeof(energymon_odroid_ioctl));
   if (state == NULL) {
@@ -214,17 +221,30 @@ int energymon_init_odroid_ioctl(energymon* em) {
     return -1;
   }
 
-  // start sensors polling thread
-  state->poll_sensors = 1;
-  errno = pthread_create(&state->thread, NULL, odroid_ioctl_poll_sensors,
-                         state);
-  if (errno) {
+  state->extrapolate = getenv(ENERGYMON_ODROID_EXTRAPOLATE) != NULL;
+  energymon_integrator_init(&state->integ, rule, state->poll_delay_us);
+
+  if (energymon_poller_adaptive_init(&state->adapt, state->poll_delay_us,
+                                     ENERGYMON_ODROID_INTERVAL_MIN_US, ENERGYMON_ODROID_INTERVAL_MAX_US)) {
+    err_save = errno;
+    fprintf(stderr, "energymon_init_odroid_ioctl: invalid polling interval bounds: "
+            ENERGYMON_ODROID_INTERVAL_MIN_US", "ENERGYMON_ODROID_INTERVAL_MAX_US"\n");
+    close_all_sensors(state);
+    free(state);
+    errno = err_save;
+    return -1;
+  }
+
+  // start polling the sensors
+  if (!(state->last_us = energymon_gettime_us()) ||
+      energymon_poller_register(&state->task, state->adapt.min_us, odroid_ioctl_poll_sensors, state)) {
     err_save = errno;
     close_all_sensors(state);
     free(state);
     errno = err_save;
     return -1;
   }
+  state->polling = 1;
 
   em->state = state;
   return 0;
@@ -235,8 +255,23 @@ uint64_t energymon_read_total_odroid_ioctl(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
+  energymon_odroid_ioctl* state = (energymon_odroid_ioctl*) em->state;
   errno = 0;
-  return ((energymon_odroid_ioctl*) em->state)->total_uj;
+  if (state->extrapolate) {
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(),
+                                           state->adapt.max_us * 1000);
+  }
+  return energymon_published_energy(&state->pub);
+}
+
+size_t energymon_read_samples_odroid_ioctl(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_odroid_ioctl* state = (energymon_odroid_ioctl*) em->state;
+  return energymon_published_read_samples(&state->pub, state->extrapolate, &state->extrapolated_uj,
+                                          state->adapt.max_us * 1000, samples, n);
 }
 
 char* energymon_get_source_odroid_ioctl(char* buffer, size_t n) {
@@ -280,3 +315,7 @@ int energymon_get_odroid_ioctl(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_odroid_ioctl(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_odroid_ioctl);
+}
@@ -9,13 +9,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-odroid.h"
+#include "energymon-integrate.h"
+#include "energymon-poller.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #include "energymon-util.h"
 
@@ -24,6 +27,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_odroid(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_odroid(ext);
+}
 #endif
 
 #define INA231_DIR "/sys/bus/i2c/drivers/INA231"
@@ -35,11 +41,20 @@ int energymon_get_default(energymon* em) {
 typedef struct energymon_odroid {
   // sensor update interval in microseconds
   unsigned long read_delay_us;
-  // thread variables
-  pthread_t thread;
-  int poll_sensors;
-  // total energy estimate
+  // shared polling thread registration
+  energymon_poller_task task;
+  int polling;
+  uint64_t last_us;
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
+  energymon_integrator integ;
+  // adapts the polling interval to the power signal
+  energymon_poller_adaptive adapt;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // extrapolate reads from the most recent sample, never returning less than extrapolated_uj
+  int extrapolate;
+  uint64_t extrapolated_uj;
   // sensor file descriptors
   unsigned int count;
   int fds[];
@@ -115,13 +130,11 @@ int energymon_finish_odroid(energymon* em) {
   unsigned int i;
   energymon_odroid* state = (energymon_odroid*) em->state;
 
-  if (state->poll_sensors) {
-    // stop sensors polling thread and cleanup
-    state->poll_sensors = 0;
-#ifndef __ANDROID__
-    pthread_cancel(state->thread);
-#endif
-    err_save = pthread_join(state->thread, NULL);
+  if (state->polling) {
+    // stop polling the sensors and cleanup
+    if (energymon_poller_unregister(&state->task)) {
+      err_save = errno;
+    }
   }
 
   // close individual sensor files
@@ -203,44 +216,31 @@ static inline char** get_sensor_directories(unsigned int* count) {
 }
 
 /**
- * pthread function to poll the sensors at regular intervals.
+ * Poller function to read the sensors at regular intervals.
  */
-static void* odroid_poll_sensors(void* args) {
+static void odroid_poll_sensors(void* args) {
   energymon_odroid* state = (energymon_odroid*) args;
   char cdata[8];
   double sum_w;
   unsigned int i;
   uint64_t exec_us;
-  uint64_t last_us;
   int err_save;
-  if (!(last_us = energymon_gettime_us())) {
-    // must be that CLOCK_MONOTONIC is not supported
-    perror("odroid_poll_sensors");
-    return (void*) NULL;
-  }
-  energymon_sleep_us(state->read_delay_us, &state->poll_sensors);
-  while (state->poll_sensors) {
-    // read individual sensors
-    for (sum_w = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
-      if (pread(state->fds[i], cdata, sizeof(cdata), 0) > 0) {
-        sum_w += strtod(cdata, NULL);
-      }
-    }
-    err_save = errno;
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    if (err_save) {
-      errno = err_save;
-      perror("odroid_poll_sensors: skipping power sensor reading");
-    } else {
-      state->total_uj += (uint64_t) (sum_w * (double) exec_us);
-    }
-    // sleep for the update interval of the sensors
-    if (state->poll_sensors) {
-      energymon_sleep_us(state->read_delay_us, &state->poll_sensors);
+  // read individual sensors
+  for (sum_w = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
+    if (pread(state->fds[i], cdata, sizeof(cdata), 0) > 0) {
+      sum_w += strtod(cdata, NULL);
     }
-    errno = 0;
   }
-  return (void*) NULL;
+  err_save = errno;
+  exec_us = energymon_gettime_elapsed_us(&state->last_us);
+  if (err_save) {
+    errno = err_save;
+    perror("odroid_poll_sensors: skipping power sensor reading");
+  } else {
+    state->total_uj += energymon_integrator_add(&state->integ, sum_w * 1000000, exec_us);
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000, (uint64_t) (sum_w * 1000000));
+    energymon_poller_set_interval(&state->task, energymon_poller_adaptive_next(&state->adapt, sum_w * 1000000));
+  }
 }
 
 /**
@@ -252,6 +252,13 @@ int energymon_init_odroid(energymon* em) {
     return -1;
   }
 
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_ODROID_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_odroid: unknown integration rule: "ENERGYMON_ODROID_INTEGRATION"=%s\n", rule_str);
+    return -1;
+  }
+
   unsigned int i;
   char file[64];
   unsigned int count;
@@ -308,16 +315,29 @@ int energymon_init_odroid(energymon* em) {
   // we're finished with this variable
   free_sensor_directories(sensor_dirs, state->count);
 
-  // start sensors polling thread
-  state->poll_sensors = 1;
-  errno = pthread_create(&state->thread, NULL, odroid_poll_sensors, state);
-  if (errno) {
+  state->extrapolate = getenv(ENERGYMON_ODROID_EXTRAPOLATE) != NULL;
+  energymon_integrator_init(&state->integ, rule, state->read_delay_us);
+
+  if (energymon_poller_adaptive_init(&state->adapt, state->read_delay_us,
+                                     ENERGYMON_ODROID_INTERVAL_MIN_US, ENERGYMON_ODROID_INTERVAL_MAX_US)) {
     err_save = errno;
+    fprintf(stderr, "energymon_init_odroid: invalid polling interval bounds: "
+            ENERGYMON_ODROID_INTERVAL_MIN_US", "ENERGYMON_ODROID_INTERVAL_MAX_US"\n");
     energymon_finish_odroid(em);
     errno = err_save;
     return -1;
   }
 
+  // start polling the sensors
+  if (!(state->last_us = energymon_gettime_us()) ||
+      energymon_poller_register(&state->task, state->adapt.min_us, odroid_poll_sensors, state)) {
+    err_save = errno;
+    energymon_finish_odroid(em);
+    errno = err_save;
+    return -1;
+  }
+  state->polling = 1;
+
   return 0;
 }
 
@@ -326,8 +346,23 @@ uint64_t energymon_read_total_odroid(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
+  energymon_odroid* state = (energymon_odroid*) em->state;
   errno = 0;
-  return ((energymon_odroid*) em->state)->total_uj;
+  if (state->extrapolate) {
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(),
+                                           state->adapt.max_us * 1000);
+  }
+  return energymon_published_energy(&state->pub);
+}
+
+size_t energymon_read_samples_odroid(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_odroid* state = (energymon_odroid*) em->state;
+  return energymon_published_read_samples(&state->pub, state->extrapolate, &state->extrapolated_uj,
+                                          state->adapt.max_us * 1000, samples, n);
 }
 
 char* energymon_get_source_odroid(char* buffer, size_t n) {
@@ -371,3 +406,7 @@ int energymon_get_odroid(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_odroid(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_odroid);
+}
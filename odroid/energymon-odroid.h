@@ -15,6 +15,29 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to extrapolate energy between samples using the most recent power reading.
+ */
+#define ENERGYMON_ODROID_EXTRAPOLATE "ENERGYMON_ODROID_EXTRAPOLATE"
+
+/*
+ * Environment variable to select the rule for integrating power samples into energy:
+ * "rectangle" (default), "trapezoid", or "window" (the sensor's averaging window).
+ */
+#define ENERGYMON_ODROID_INTEGRATION "ENERGYMON_ODROID_INTEGRATION"
+
+/*
+ * Environment variable to enable adaptive polling: while the power is flat, the polling interval backs off up to this
+ * many microseconds, and returns to the minimum when the power changes.
+ */
+#define ENERGYMON_ODROID_INTERVAL_MAX_US "ENERGYMON_ODROID_INTERVAL_MAX_US"
+
+/*
+ * Environment variable to override the minimum adaptive polling interval in microseconds (defaults to the sensor update
+ * interval).
+ */
+#define ENERGYMON_ODROID_INTERVAL_MIN_US "ENERGYMON_ODROID_INTERVAL_MIN_US"
+
 int energymon_init_odroid(energymon* em);
 
 uint64_t energymon_read_total_odroid(const energymon* em);
@@ -31,6 +54,10 @@ int energymon_is_exclusive_odroid(void);
 
 int energymon_get_odroid(energymon* em);
 
+size_t energymon_read_samples_odroid(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_odroid(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
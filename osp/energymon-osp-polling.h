@@ -14,6 +14,12 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to select the rule for integrating power samples into energy:
+ * "rectangle" (default), "trapezoid", or "window" (the sensor's averaging window).
+ */
+#define ENERGYMON_OSP_INTEGRATION "ENERGYMON_OSP_INTEGRATION"
+
 int energymon_init_osp_polling(energymon* em);
 
 uint64_t energymon_read_total_osp_polling(const energymon* em);
@@ -30,6 +36,10 @@ int energymon_is_exclusive_osp_polling(void);
 
 int energymon_get_osp_polling(energymon* em);
 
+size_t energymon_read_samples_osp_polling(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_osp_polling(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,9 +31,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #ifdef ENERGYMON_OSP_USE_POLLING
 #include <pthread.h>
+#include "energymon-integrate.h"
 #include "energymon-osp-polling.h"
+#include "energymon-published.h"
 #else
 #include "energymon-osp.h"
 #endif
@@ -49,6 +52,11 @@ int energymon_get_default(energymon* em) {
   return energymon_get_osp(em);
 #endif
 }
+#ifdef ENERGYMON_OSP_USE_POLLING
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_osp_polling(ext);
+}
+#endif
 #endif
 
 #define OSP_BUF_SIZE            65
@@ -104,7 +112,11 @@ typedef struct energymon_osp {
   hid_device* device;
   unsigned char buf[OSP_BUF_SIZE];
 #ifdef ENERGYMON_OSP_USE_POLLING
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
+  energymon_integrator integ;
+  // the most recent sample, for readers
+  energymon_published pub;
   pthread_t thread;
   int poll;
 #else
@@ -247,6 +259,7 @@ static void* osp_poll_device(void* args) {
   double watts;
   uint64_t exec_us;
   uint64_t last_us;
+  energymon_periodic period;
 #ifndef __ANDROID__
   int dummy_old_state;
 #endif
@@ -255,6 +268,7 @@ static void* osp_poll_device(void* args) {
     perror("osp_poll_device: energymon_gettime_us");
     return (void*) NULL;
   }
+  energymon_periodic_init(&period, ENERGYMON_OSP_POLL_DELAY_US);
   while (state->poll) {
 #ifndef __ANDROID__
     // Deadlock can occur during disconnect if thread is canceled during I/O
@@ -276,13 +290,14 @@ static void* osp_poll_device(void* args) {
       watts = 0;
     }
     exec_us = energymon_gettime_elapsed_us(&last_us);
-    state->total_uj += (uint64_t) (watts * (double) exec_us);
-    // sleep for the polling delay
+    state->total_uj += energymon_integrator_add(&state->integ, watts * 1000000, exec_us);
+    energymon_published_store(&state->pub, state->total_uj, last_us * 1000, (uint64_t) (watts * 1000000));
+    // sleep until the next polling deadline
     if (state->poll) {
 #ifndef __ANDROID__
       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &dummy_old_state);
 #endif
-      energymon_sleep_us(ENERGYMON_OSP_POLL_DELAY_US, &state->poll);
+      energymon_periodic_wait(&period, &state->poll);
     }
   }
   return (void*) NULL;
@@ -312,6 +327,14 @@ int energymon_init_osp(energymon* em) {
     errno = EINVAL;
     return -1;
   }
+#ifdef ENERGYMON_OSP_USE_POLLING
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_OSP_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_osp: unknown integration rule: "ENERGYMON_OSP_INTEGRATION"=%s\n", rule_str);
+    return -1;
+  }
+#endif
   int is_started;
   int is_on;
 
@@ -375,6 +398,7 @@ int energymon_init_osp(energymon* em) {
 
 #ifdef ENERGYMON_OSP_USE_POLLING
   // start device polling thread
+  energymon_integrator_init(&state->integ, rule, ENERGYMON_OSP_POLL_DELAY_US);
   state->poll = 1;
   errno = pthread_create(&state->thread, NULL, osp_poll_device, state);
   if (errno) {
@@ -397,7 +421,7 @@ uint64_t energymon_read_total_osp(const energymon* em) {
   energymon_osp* state = (energymon_osp*) em->state;
 #ifdef ENERGYMON_OSP_USE_POLLING
   errno = 0;
-  return state->total_uj;
+  return energymon_published_energy(&state->pub);
 #else
   double wh;
   if (em_osp_request_data_retry(state, ENERGYMON_OSP_RETRIES, NULL)) {
@@ -431,6 +455,17 @@ uint64_t energymon_read_total_osp(const energymon* em) {
 #endif
 }
 
+#ifdef ENERGYMON_OSP_USE_POLLING
+size_t energymon_read_samples_osp_polling(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_osp* state = (energymon_osp*) em->state;
+  return energymon_published_read_samples(&state->pub, 0, NULL, 0, samples, n);
+}
+#endif
+
 #ifdef ENERGYMON_OSP_USE_POLLING
 int energymon_finish_osp_polling(energymon* em) {
 #else
@@ -524,3 +559,9 @@ int energymon_get_osp(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+#ifdef ENERGYMON_OSP_USE_POLLING
+int energymon_get_ext_osp_polling(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_osp_polling);
+}
+#endif
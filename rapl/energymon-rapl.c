@@ -6,16 +6,20 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "energymon.h"
+#include "energymon-ext.h"
+#include "energymon-poller.h"
+#include "energymon-pread-batch.h"
 #include "energymon-rapl.h"
+#include "energymon-time-util.h"
 #include "energymon-util.h"
 
 #ifdef ENERGYMON_DEFAULT
@@ -23,100 +27,195 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_rapl(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_rapl(ext);
+}
 #endif
 
-#define RAPL_BASE_DIR "/sys/class/powercap"
+#define RAPL_BASE_DIR_DEFAULT "/sys/class/powercap"
 #define RAPL_ENERGY_FILE "energy_uj"
 #define RAPL_MAX_ENERGY_FILE "max_energy_range_uj"
 #define RAPL_NAME_FILE "name"
-#define RAPL_PREFIX "intel-rapl:"
+#define RAPL_MAX_POWER_FILE "constraint_0_max_power_uw"
+#define RAPL_DOMAINS_DEFAULT "package"
+#define RAPL_PATH_LEN 512
+
+// keep-alive reads happen at this fraction of the time to overflow at the zone's max (or TDP) power
+#ifndef RAPL_KEEPALIVE_FRACTION
+  #define RAPL_KEEPALIVE_FRACTION 4
+#endif
+// assumed power for zones that don't report a max power
+#ifndef RAPL_KEEPALIVE_POWER_DEFAULT_UW
+  #define RAPL_KEEPALIVE_POWER_DEFAULT_UW 500000000
+#endif
+
+#define ENERGYMON_RAPL_IO_URING "ENERGYMON_RAPL_IO_URING"
+
+// powercap control types that expose RAPL zones - if a zone is exposed by more than one, the first is used
+static const char* const RAPL_CONTROL_TYPES[] = { "intel-rapl", "intel-rapl-mmio", "amd-rapl" };
+#define RAPL_CONTROL_TYPES_LEN (sizeof(RAPL_CONTROL_TYPES) / sizeof(RAPL_CONTROL_TYPES[0]))
+
+// domains that can be selected, as a bitmask of their indexes
+static const char* const RAPL_DOMAINS[] = { "package", "core", "uncore", "dram", "psys" };
+#define RAPL_DOMAINS_LEN (sizeof(RAPL_DOMAINS) / sizeof(RAPL_DOMAINS[0]))
 
 typedef struct rapl_zone {
   uint64_t max_energy_range_uj;
   uint64_t energy_last;
   unsigned int energy_overflow_count;
   int energy_fd;
+  // large enough for a 20-digit value and a newline
+  char energy_buf[24];
+  char name[ENERGYMON_CHANNEL_NAME_LEN];
 } rapl_zone;
 
 typedef struct energymon_rapl {
+  // selected zones are first in the zones array, followed by all other zones
   unsigned int count;
+  unsigned int count_all;
+  // reads for zones[i] are ops[i], so any prefix of zones can be read in a batch
+  energymon_pread_op* ops;
+  energymon_pread_batch batch;
+  // optional keep-alive polling, so counter overflows aren't missed between sparse reads
+  int keepalive;
+  energymon_poller_task task;
+  // serializes reads with the keep-alive poller
+  pthread_mutex_t lock;
   rapl_zone zones[];
 } energymon_rapl;
 
+// a zone found during discovery
+typedef struct rapl_zone_info {
+  // the zone's directory, e.g., "intel-rapl:0:1"
+  char zone[48];
+  // the zone's name, qualified by its parent's name for subzones, e.g., "package-0:dram"
+  char name[ENERGYMON_CHANNEL_NAME_LEN];
+  // the zone's domain as a bitmask of its RAPL_DOMAINS index, or 0 if unknown
+  unsigned int domain;
+  uint64_t max_energy_range_uj;
+  // 0 if the zone has no constraints
+  uint64_t max_power_uw;
+  int selected;
+} rapl_zone_info;
+
+typedef struct rapl_zone_infos {
+  rapl_zone_info* infos;
+  unsigned int count;
+  unsigned int n_selected;
+} rapl_zone_infos;
+
+// discovered zones are shared by all instances
+static pthread_mutex_t rapl_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static rapl_zone_infos rapl_cache;
+static char rapl_cache_root[RAPL_PATH_LEN];
+
 /**
- * Count the number of RAPL zones (does not include subzones).
- * Returns 0 on error (check errno) or if no RAPL zones found.
+ * Parse a comma-delimited list of domain names into a bitmask.
+ * Returns 0 on success, -1 on error.
  */
-static inline unsigned int rapl_zone_count(void) {
-  unsigned int count = 0;
-  int err_save;
-  struct dirent* entry;
-  DIR* dir = opendir(RAPL_BASE_DIR);
-  if (dir == NULL) {
-    perror(RAPL_BASE_DIR);
-    return 0;
-  }
-  for (errno = 0; (entry = readdir(dir)) != NULL;) {
-    // no order guarantee from readdir, so just count directories of the form
-    // "intel-rapl:#", but not "intel-rapl:#:#"
-    if (strncmp(entry->d_name, RAPL_PREFIX, sizeof(RAPL_PREFIX) - 1) == 0 &&
-        strchr(entry->d_name + sizeof(RAPL_PREFIX) - 1, ':') == NULL) {
-      count++;
+static int rapl_parse_domains(const char* str, unsigned int* domains) {
+  size_t len;
+  unsigned int i;
+  *domains = 0;
+  while (*str != '\0') {
+    len = strcspn(str, ",");
+    for (i = 0; i < RAPL_DOMAINS_LEN; i++) {
+      if (strlen(RAPL_DOMAINS[i]) == len && strncmp(str, RAPL_DOMAINS[i], len) == 0) {
+        *domains |= 1U << i;
+        break;
+      }
+    }
+    if (i == RAPL_DOMAINS_LEN) {
+      fprintf(stderr, "energymon_init_rapl: unknown domain in "ENERGYMON_RAPL_DOMAINS": %.*s\n", (int) len, str);
+      errno = EINVAL;
+      return -1;
+    }
+    str += len;
+    if (*str == ',') {
+      str++;
     }
   }
-  err_save = errno; // from readdir
-  if (closedir(dir)) {
-    perror(RAPL_BASE_DIR);
+  if (*domains == 0) {
+    fprintf(stderr, "energymon_init_rapl: no domains specified in "ENERGYMON_RAPL_DOMAINS"\n");
+    errno = EINVAL;
+    return -1;
   }
-  errno = err_save;
-  return errno ? 0 : count;
+  return 0;
 }
 
-static inline unsigned int rapl_filter_zones(unsigned int* zone_filter,
-                                             unsigned int count) {
-  char buf[96];
-  char name[64];
-  unsigned int n_filter_matches = 0;
+/**
+ * Zone names are the domain name, with an index suffix for packages, e.g., "package-0".
+ * Returns the domain's bit, or 0 if unknown.
+ */
+static unsigned int rapl_domain_bit(const char* name) {
+  size_t len;
   unsigned int i;
-  int fd;
-  int err_save;
-  for (i = 0; i < count; i++) {
-    snprintf(buf, sizeof(buf), RAPL_BASE_DIR"/intel-rapl:%x/%s",
-             i, RAPL_NAME_FILE);
-    errno = 0;
-    fd = open(buf, O_RDONLY);
-    if (fd > 0) {
-      if (pread(fd, name, sizeof(name), 0) > 0) {
-        if (strncmp(name, "package", sizeof("package") - 1) == 0) {
-          zone_filter[i] = 1;
-          n_filter_matches++;
-        }
-      }
-      err_save = errno;
-      if (close(fd)) {
-        perror(buf);
-      }
-      errno = err_save;
+  for (i = 0; i < RAPL_DOMAINS_LEN; i++) {
+    len = strlen(RAPL_DOMAINS[i]);
+    if (strncmp(name, RAPL_DOMAINS[i], len) == 0 && (name[len] == '\0' || name[len] == '-')) {
+      return 1U << i;
     }
-    if (errno) {
+  }
+  return 0;
+}
+
+/**
+ * Returns 1 if the zone exists, 0 if not, -1 on error.
+ */
+static int rapl_zone_exists(const char* root, const char* zone) {
+  char buf[RAPL_PATH_LEN];
+  snprintf(buf, sizeof(buf), "%s/%s", root, zone);
+  if (access(buf, F_OK) == 0) {
+    return 1;
+  }
+  if (errno == ENOENT) {
+    errno = 0;
+    return 0;
+  }
+  perror(buf);
+  return -1;
+}
+
+/**
+ * Read a zone's name (without trailing newline).
+ * Returns 0 on success, -1 on error.
+ */
+static inline int rapl_read_name(const char* root, const char* zone, char* name, size_t len) {
+  char buf[RAPL_PATH_LEN];
+  ssize_t ret = -1;
+  int err_save;
+  int fd;
+  snprintf(buf, sizeof(buf), "%s/%s/%s", root, zone, RAPL_NAME_FILE);
+  errno = 0;
+  fd = open(buf, O_RDONLY);
+  if (fd > 0) {
+    ret = pread(fd, name, len - 1, 0);
+    err_save = errno;
+    if (close(fd)) {
       perror(buf);
-      return 0;
     }
+    errno = err_save;
   }
-  return n_filter_matches;
+  if (ret < 0) {
+    perror(buf);
+    return -1;
+  }
+  name[ret] = '\0';
+  name[strcspn(name, "\n")] = '\0';
+  return 0;
 }
 
 /**
- * Returns 0 on error (check errno), otherwise the max energy.
+ * Returns 0 on error (check errno), otherwise the file's value.
+ * If quiet, errors aren't printed, e.g., for optional files.
  */
-static inline uint64_t rapl_read_max_energy(unsigned int zone) {
+static inline uint64_t rapl_read_u64(const char* root, const char* zone, const char* file, int quiet) {
   uint64_t ret = 0;
   int err_save;
-  char buf[96];
+  char buf[RAPL_PATH_LEN];
   char data[30];
   int fd;
-  snprintf(buf, sizeof(buf), RAPL_BASE_DIR"/intel-rapl:%x/%s",
-           zone, RAPL_MAX_ENERGY_FILE);
+  snprintf(buf, sizeof(buf), "%s/%s/%s", root, zone, file);
   errno = 0;
   fd = open(buf, O_RDONLY);
   if (fd > 0) {
@@ -129,16 +228,166 @@ static inline uint64_t rapl_read_max_energy(unsigned int zone) {
     }
     errno = err_save;
   }
-  if (errno) {
+  if (errno && !quiet) {
     perror(buf);
   }
   return ret;
 }
 
-static inline int rapl_cleanup(const energymon_rapl* state, int errno_orig) {
+/**
+ * Add a zone to the discovered zones, unless a zone with the same name was already found.
+ * Returns 0 on success, -1 on error.
+ */
+static int rapl_discover_zone(rapl_zone_infos* zi, const char* root, const char* zone, const char* parent_name,
+                              char* name, size_t name_len) {
+  char domain[ENERGYMON_CHANNEL_NAME_LEN];
+  rapl_zone_info* infos;
+  unsigned int i;
+  size_t len = 0;
+  if (rapl_read_name(root, zone, domain, sizeof(domain))) {
+    return -1;
+  }
+  // qualify subzone names with their parent, e.g., "package-0:dram"
+  if (parent_name != NULL) {
+    len = strlen(energymon_strencpy(name, parent_name, name_len - 1));
+    name[len++] = ':';
+  }
+  energymon_strencpy(name + len, domain, name_len - len);
+  for (i = 0; i < zi->count; i++) {
+    if (strcmp(zi->infos[i].name, name) == 0) {
+      // another control type already exposes this zone, e.g., intel-rapl-mmio duplicates intel-rapl packages
+      return 0;
+    }
+  }
+  // inefficient to realloc every iteration, but straightforward
+  if ((infos = realloc(zi->infos, (zi->count + 1) * sizeof(rapl_zone_info))) == NULL) {
+    return -1;
+  }
+  zi->infos = infos;
+  energymon_strencpy(infos[zi->count].zone, zone, sizeof(infos[zi->count].zone));
+  energymon_strencpy(infos[zi->count].name, name, sizeof(infos[zi->count].name));
+  infos[zi->count].domain = rapl_domain_bit(domain);
+  infos[zi->count].selected = 0;
+  // it's possible the actual value is 0 (not set), so only fail on error
+  infos[zi->count].max_energy_range_uj = rapl_read_u64(root, zone, RAPL_MAX_ENERGY_FILE, 0);
+  if (infos[zi->count].max_energy_range_uj == 0 && errno) {
+    return -1;
+  }
+  // not all zones have constraints, so don't complain if it's missing
+  infos[zi->count].max_power_uw = rapl_read_u64(root, zone, RAPL_MAX_POWER_FILE, 1);
+  zi->count++;
+  return 0;
+}
+
+/**
+ * Find all zones and subzones of all RAPL control types.
+ * Zones and subzones are numbered contiguously, e.g., "intel-rapl:0" and "intel-rapl:0:0".
+ * Returns 0 on success, -1 on error.
+ */
+static int rapl_discover(rapl_zone_infos* zi, const char* root) {
+  char zone[48];
+  char subzone[48];
+  char name[ENERGYMON_CHANNEL_NAME_LEN];
+  char subname[ENERGYMON_CHANNEL_NAME_LEN];
+  unsigned int t;
+  unsigned int i;
+  unsigned int j;
+  int exists;
+  for (t = 0; t < RAPL_CONTROL_TYPES_LEN; t++) {
+    for (i = 0; ; i++) {
+      snprintf(zone, sizeof(zone), "%s:%x", RAPL_CONTROL_TYPES[t], i);
+      if ((exists = rapl_zone_exists(root, zone)) <= 0) {
+        break;
+      }
+      if (rapl_discover_zone(zi, root, zone, NULL, name, sizeof(name))) {
+        return -1;
+      }
+      for (j = 0; ; j++) {
+        snprintf(subzone, sizeof(subzone), "%s:%x:%x", RAPL_CONTROL_TYPES[t], i, j);
+        if ((exists = rapl_zone_exists(root, subzone)) <= 0) {
+          break;
+        }
+        if (rapl_discover_zone(zi, root, subzone, name, subname, sizeof(subname))) {
+          return -1;
+        }
+      }
+      if (exists < 0) {
+        return -1;
+      }
+    }
+    if (exists < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Get a private copy of the zones in root, only discovering them if the result isn't already cached.
+ * Zones don't change while the driver is loaded, so the result is shared by all instances in the process.
+ * Returns 0 on success, -1 on error.
+ */
+static int rapl_discover_cached(rapl_zone_infos* zi, const char* root) {
+  int ret = 0;
+  pthread_mutex_lock(&rapl_cache_lock);
+  if (rapl_cache.infos == NULL || strcmp(root, rapl_cache_root) != 0) {
+    free(rapl_cache.infos);
+    memset(&rapl_cache, 0, sizeof(rapl_cache));
+    ret = rapl_discover(&rapl_cache, root);
+    if (ret || rapl_cache.count == 0) {
+      // don't cache failures, e.g., so a later init can succeed once the driver is loaded
+      free(rapl_cache.infos);
+      memset(&rapl_cache, 0, sizeof(rapl_cache));
+    } else {
+      energymon_strencpy(rapl_cache_root, root, sizeof(rapl_cache_root));
+    }
+  }
+  if (rapl_cache.count > 0) {
+    if ((zi->infos = malloc(rapl_cache.count * sizeof(rapl_zone_info))) == NULL) {
+      ret = -1;
+    } else {
+      memcpy(zi->infos, rapl_cache.infos, rapl_cache.count * sizeof(rapl_zone_info));
+      zi->count = rapl_cache.count;
+    }
+  }
+  pthread_mutex_unlock(&rapl_cache_lock);
+  return ret;
+}
+
+/**
+ * Forget the cached zones, e.g., if they no longer exist.
+ */
+static void rapl_discover_cache_clear(void) {
+  pthread_mutex_lock(&rapl_cache_lock);
+  free(rapl_cache.infos);
+  memset(&rapl_cache, 0, sizeof(rapl_cache));
+  pthread_mutex_unlock(&rapl_cache_lock);
+}
+
+/**
+ * Select zones in the requested domains.
+ */
+static void rapl_select(rapl_zone_infos* zi, unsigned int domains) {
+  unsigned int i;
+  zi->n_selected = 0;
+  for (i = 0; i < zi->count; i++) {
+    zi->infos[i].selected = (zi->infos[i].domain & domains) != 0;
+    zi->n_selected += (unsigned int) zi->infos[i].selected;
+  }
+}
+
+static inline int rapl_cleanup(energymon_rapl* state, int errno_orig) {
   int err_save = errno_orig;
   unsigned int i;
-  for (i = 0; i < state->count; i++) {
+  if (state->keepalive && energymon_poller_unregister(&state->task)) {
+    err_save = err_save ? err_save : errno;
+  }
+  if (state->ops != NULL) {
+    energymon_pread_batch_destroy(&state->batch);
+    free(state->ops);
+  }
+  pthread_mutex_destroy(&state->lock);
+  for (i = 0; i < state->count_all; i++) {
     if (state->zones[i].energy_fd > 0 && close(state->zones[i].energy_fd)) {
       err_save = err_save ? err_save : errno;
     }
@@ -147,121 +396,203 @@ static inline int rapl_cleanup(const energymon_rapl* state, int errno_orig) {
   return errno ? -1 : 0;
 }
 
-static inline int rapl_zone_init(rapl_zone* z, unsigned int zone) {
-  char buf[96];
-  snprintf(buf, sizeof(buf), RAPL_BASE_DIR"/intel-rapl:%x/%s",
-           zone, RAPL_ENERGY_FILE);
+static inline int rapl_zone_init(rapl_zone* z, const char* root, const rapl_zone_info* info) {
+  char buf[RAPL_PATH_LEN];
+  energymon_strencpy(z->name, info->name, sizeof(z->name));
+  snprintf(buf, sizeof(buf), "%s/%s/%s", root, info->zone, RAPL_ENERGY_FILE);
   z->energy_fd = open(buf, O_RDONLY);
   if (z->energy_fd <= 0) {
     perror(buf);
     return -1;
   }
-  // it's possible the actual value is 0 (not set), so only fail on error
-  z->max_energy_range_uj = rapl_read_max_energy(zone);
-  if (z->max_energy_range_uj == 0 && errno) {
-    return -1;
-  }
+  z->max_energy_range_uj = info->max_energy_range_uj;
   return 0;
 }
 
-static inline int rapl_init(energymon_rapl* state, unsigned int count,
-                            unsigned int* zone_filter,
-                            unsigned int n_filter_matches) {
+/**
+ * The keep-alive interval for a zone: a fraction of the time it takes the counter to overflow at the zone's max power.
+ * Returns 0 if the zone's counter doesn't overflow.
+ */
+static uint64_t rapl_keepalive_interval_us(const rapl_zone_info* info) {
+  uint64_t power_uw = info->max_power_uw > 0 ? info->max_power_uw : RAPL_KEEPALIVE_POWER_DEFAULT_UW;
+  uint64_t interval_us;
+  if (info->max_energy_range_uj == 0) {
+    return 0;
+  }
+  interval_us = info->max_energy_range_uj * 1000000 / power_uw / RAPL_KEEPALIVE_FRACTION;
+  return interval_us < 1000 ? 1000 : interval_us;
+}
+
+/**
+ * If keepalive_us is not NULL and is 0, it's set to the computed keep-alive interval (0 if no zone overflows).
+ */
+static inline int rapl_init(energymon_rapl* state, const char* root, const rapl_zone_infos* zi,
+                            uint64_t* keepalive_us) {
+  uint64_t zone_us;
+  uint64_t min_us = 0;
   unsigned int i;
-  unsigned int zones_idx = 0;
-  state->count = n_filter_matches;
-  for (i = 0; i < count; i++) {
-    if (zone_filter[i] == 0) {
-      continue;
-    }
-    if (rapl_zone_init(&state->zones[zones_idx], i) < 0) {
+  unsigned int selected_idx = 0;
+  unsigned int others_idx = zi->n_selected;
+  rapl_zone* z;
+  state->count = zi->n_selected;
+  state->count_all = zi->count;
+  for (i = 0; i < zi->count; i++) {
+    z = zi->infos[i].selected ? &state->zones[selected_idx++] : &state->zones[others_idx++];
+    if (rapl_zone_init(z, root, &zi->infos[i]) < 0) {
       return rapl_cleanup(state, errno);
     }
-    zones_idx++;
+    // keep-alive reads include all zones, since they're all exposed as channels
+    if (keepalive_us != NULL && (zone_us = rapl_keepalive_interval_us(&zi->infos[i])) > 0 &&
+        (min_us == 0 || zone_us < min_us)) {
+      min_us = zone_us;
+    }
+  }
+  if (keepalive_us != NULL && *keepalive_us == 0) {
+    *keepalive_us = min_us;
+  }
+  if ((state->ops = malloc(zi->count * sizeof(energymon_pread_op))) == NULL) {
+    return rapl_cleanup(state, errno);
+  }
+  for (i = 0; i < zi->count; i++) {
+    state->ops[i].fd = state->zones[i].energy_fd;
+    state->ops[i].buf = state->zones[i].energy_buf;
+    state->ops[i].len = sizeof(state->zones[i].energy_buf);
+  }
+  // io_uring submits all zone reads in a single system call
+  if (energymon_pread_batch_init(&state->batch, state->ops, zi->count,
+                                 getenv(ENERGYMON_RAPL_IO_URING) != NULL)) {
+    free(state->ops);
+    state->ops = NULL;
+    return rapl_cleanup(state, errno);
   }
   return 0;
 }
 
+/**
+ * Returns 0 on error (check errno), otherwise the zone's energy value.
+ */
+static inline uint64_t rapl_zone_update(rapl_zone* z, const energymon_pread_op* op) {
+  uint64_t val;
+  if (energymon_parse_u64(z->energy_buf, (size_t) op->ret, &val)) {
+    return 0;
+  }
+  // attempt to detect overflow of counter
+  if (val < z->energy_last) {
+    z->energy_overflow_count++;
+  }
+  z->energy_last = val;
+  val += z->energy_overflow_count * z->max_energy_range_uj;
+  return val;
+}
+
+/**
+ * Called from the polling thread to read all zones often enough that no overflow is missed.
+ */
+static void rapl_keepalive(void* arg) {
+  energymon_rapl* state = (energymon_rapl*) arg;
+  unsigned int i;
+  pthread_mutex_lock(&state->lock);
+  // errors are reported by the next (non-keep-alive) read
+  if (!energymon_pread_batch_read(&state->batch, state->count_all)) {
+    for (i = 0; i < state->count_all; i++) {
+      rapl_zone_update(&state->zones[i], &state->ops[i]);
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+}
+
 int energymon_init_rapl(energymon* em) {
   if (em == NULL || em->state != NULL) {
     errno = EINVAL;
     return -1;
   }
 
-  unsigned int count = rapl_zone_count();
-  if (count == 0) {
-    if (errno) {
-      perror(RAPL_BASE_DIR);
-    } else {
-      fprintf(stderr, "energymon_init_rapl: No RAPL zones found!\n");
-      errno = ENODEV;
-    }
+  const char* root = getenv(ENERGYMON_RAPL_ROOT);
+  const char* domains_str = getenv(ENERGYMON_RAPL_DOMAINS);
+  const char* keepalive_str = getenv(ENERGYMON_RAPL_KEEPALIVE);
+  unsigned int domains;
+  uint64_t keepalive_us = 0;
+  rapl_zone_infos zi = { 0 };
+  int err_save;
+  if (root == NULL) {
+    root = RAPL_BASE_DIR_DEFAULT;
+  }
+  // an empty value (or 0) uses the computed interval
+  if (keepalive_str != NULL && *keepalive_str != '\0' && energymon_parse_u64(keepalive_str, strlen(keepalive_str),
+                                                                              &keepalive_us)) {
+    fprintf(stderr, "energymon_init_rapl: invalid keep-alive interval: "ENERGYMON_RAPL_KEEPALIVE"=%s\n",
+            keepalive_str);
+    errno = EINVAL;
+    return -1;
+  }
+  if (rapl_parse_domains(domains_str == NULL ? RAPL_DOMAINS_DEFAULT : domains_str, &domains)) {
     return -1;
   }
 
-  unsigned int* zone_filter = calloc(count, sizeof(unsigned int));
-  if (zone_filter == NULL) {
+  if (rapl_discover_cached(&zi, root)) {
     return -1;
   }
-  unsigned int n_filter_matches = rapl_filter_zones(zone_filter, count);
-  if (n_filter_matches == 0) {
-    if (!errno) {
-      errno = ENODEV;
-    }
-    fprintf(stderr, "energymon_init_rapl: No package zones found!\n");
-    free(zone_filter);
+  if (zi.count == 0) {
+    fprintf(stderr, "energymon_init_rapl: No RAPL zones found in %s!\n", root);
+    errno = ENODEV;
+    return -1;
+  }
+  rapl_select(&zi, domains);
+  if (zi.n_selected == 0) {
+    fprintf(stderr, "energymon_init_rapl: No zones found for the requested domain(s): %s\n",
+            domains_str == NULL ? RAPL_DOMAINS_DEFAULT : domains_str);
+    free(zi.infos);
+    errno = ENODEV;
     return -1;
   }
 
-  size_t size = sizeof(energymon_rapl) + n_filter_matches * sizeof(rapl_zone);
+  // unselected zones aren't included in the total, but are exposed as channels
+  size_t size = sizeof(energymon_rapl) + zi.count * sizeof(rapl_zone);
   energymon_rapl* state = calloc(1, size);
   if (state == NULL) {
-    free(zone_filter);
+    free(zi.infos);
     return -1;
   }
 
-  if (rapl_init(state, count, zone_filter, n_filter_matches)) {
-    free(zone_filter);
+  pthread_mutex_init(&state->lock, NULL);
+  if (rapl_init(state, root, &zi, keepalive_str == NULL ? NULL : &keepalive_us)) {
+    // the cached zones may be stale, e.g., if the driver was reloaded
+    rapl_discover_cache_clear();
+    free(zi.infos);
     free(state);
     return -1;
   }
+  free(zi.infos);
+
+  // if no zone overflows, there's nothing to keep alive
+  if (keepalive_us > 0) {
+    if (energymon_poller_register(&state->task, keepalive_us, &rapl_keepalive, state)) {
+      err_save = errno;
+      perror("energymon_init_rapl: Failed to start keep-alive polling");
+      rapl_cleanup(state, err_save);
+      free(state);
+      return -1;
+    }
+    state->keepalive = 1;
+  }
 
-  free(zone_filter);
   em->state = state;
   return 0;
 }
 
-/**
- * Returns 0 on error (check errno), otherwise the zone's energy value.
- */
-static inline uint64_t rapl_zone_read(rapl_zone* z) {
-  uint64_t val = 0;
-  char buf[30];
-  errno = 0;
-  if (pread(z->energy_fd, buf, sizeof(buf), 0) > 0) {
-    val = strtoull(buf, NULL, 0);
-  }
-  if (errno) { // from pread or strtoull
-    return 0;
-  }
-  // attempt to detect overflow of counter
-  if (val < z->energy_last) {
-    z->energy_overflow_count++;
-  }
-  z->energy_last = val;
-  val += z->energy_overflow_count * z->max_energy_range_uj;
-  return val;
-}
-
 /**
  * Returns 0 on error (check errno), otherwise the total energy across zones.
  */
-static inline uint64_t rapl_read_total_energy_uj(energymon_rapl* em) {
+static inline uint64_t rapl_sum_energy_uj(energymon_rapl* em) {
   uint64_t val = 0;
   uint64_t total = 0;
   unsigned int i;
+  errno = 0;
+  if (energymon_pread_batch_read(&em->batch, em->count)) {
+    return 0;
+  }
   for (i = 0; i < em->count; i++) {
-    val = rapl_zone_read(&em->zones[i]);
+    val = rapl_zone_update(&em->zones[i], &em->ops[i]);
     if (val == 0 && errno) {
       return 0;
     }
@@ -270,6 +601,18 @@ static inline uint64_t rapl_read_total_energy_uj(energymon_rapl* em) {
   return total;
 }
 
+static inline uint64_t rapl_read_total_energy_uj(energymon_rapl* em) {
+  uint64_t total;
+  if (em->keepalive) {
+    pthread_mutex_lock(&em->lock);
+  }
+  total = rapl_sum_energy_uj(em);
+  if (em->keepalive) {
+    pthread_mutex_unlock(&em->lock);
+  }
+  return total;
+}
+
 uint64_t energymon_read_total_rapl(const energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
@@ -279,6 +622,62 @@ uint64_t energymon_read_total_rapl(const energymon* em) {
   return rapl_read_total_energy_uj(em->state);
 }
 
+size_t energymon_read_samples_rapl(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_rapl* state = (energymon_rapl*) em->state;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    samples[i].time_ns = energymon_gettime_ns();
+    samples[i].energy_uj = rapl_read_total_energy_uj(state);
+    if (samples[i].energy_uj == 0 && errno) {
+      break;
+    }
+  }
+  return i;
+}
+
+static inline size_t rapl_read_channels(energymon_rapl* state, energymon_channel* channels) {
+  unsigned int i;
+  errno = 0;
+  if (energymon_pread_batch_read(&state->batch, state->count_all)) {
+    return 0;
+  }
+  for (i = 0; i < state->count_all; i++) {
+    channels[i].energy_uj = rapl_zone_update(&state->zones[i], &state->ops[i]);
+    if (channels[i].energy_uj == 0 && errno) {
+      return 0;
+    }
+    memcpy(channels[i].name, state->zones[i].name, sizeof(channels[i].name));
+  }
+  return state->count_all;
+}
+
+size_t energymon_read_channels_rapl(const energymon* em, energymon_channel* channels, size_t n) {
+  if (em == NULL || em->state == NULL || (channels == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_rapl* state = (energymon_rapl*) em->state;
+  if (n == 0) {
+    return state->count_all;
+  }
+  if (n < state->count_all) {
+    errno = ENOBUFS;
+    return 0;
+  }
+  if (state->keepalive) {
+    pthread_mutex_lock(&state->lock);
+  }
+  n = rapl_read_channels(state, channels);
+  if (state->keepalive) {
+    pthread_mutex_unlock(&state->lock);
+  }
+  return n;
+}
+
 int energymon_finish_rapl(energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
@@ -331,3 +730,16 @@ int energymon_get_rapl(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_rapl(energymon_ext* ext) {
+  if (energymon_ext_clear(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_samples)) {
+    ext->fread_samples = &energymon_read_samples_rapl;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_channels)) {
+    ext->fread_channels = &energymon_read_channels_rapl;
+  }
+  return 0;
+}
@@ -15,6 +15,26 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to override the powercap sysfs directory (default: "/sys/class/powercap"), e.g., for testing.
+ */
+#define ENERGYMON_RAPL_ROOT "ENERGYMON_RAPL_ROOT"
+
+/*
+ * Environment variable for specifying a comma-delimited list of domains to include in the total energy:
+ * "package" (default), "core", "uncore", "dram", and/or "psys".
+ */
+#define ENERGYMON_RAPL_DOMAINS "ENERGYMON_RAPL_DOMAINS"
+
+/*
+ * Environment variable to enable a background keep-alive that reads all zones often enough that no counter overflow
+ * is missed, even if the application reads rarely.
+ * If set to a positive integer, it's the keep-alive interval in microseconds.
+ * Otherwise (e.g., empty or 0), the interval is a fraction of the shortest time for a zone's counter to overflow at
+ * its max power.
+ */
+#define ENERGYMON_RAPL_KEEPALIVE "ENERGYMON_RAPL_KEEPALIVE"
+
 int energymon_init_rapl(energymon* em);
 
 uint64_t energymon_read_total_rapl(const energymon* em);
@@ -31,6 +51,12 @@ int energymon_is_exclusive_rapl(void);
 
 int energymon_get_rapl(energymon* em);
 
+size_t energymon_read_samples_rapl(const energymon* em, energymon_sample* samples, size_t n);
+
+size_t energymon_read_channels_rapl(const energymon* em, energymon_channel* channels, size_t n);
+
+int energymon_get_ext_rapl(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,12 +6,14 @@
  */
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <raplcap.h>
 #include <raplcap-msr.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-raplcap-msr.h"
 #include "energymon-util.h"
 
@@ -20,26 +22,59 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_raplcap_msr(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_raplcap_msr(ext);
+}
 #endif
 
-typedef struct raplcap_msr_info {
+// a RAPL instance - packages may have different numbers of die, so instances are numbered contiguously
+typedef struct raplcap_msr_pd {
+  uint32_t pkg;
+  uint32_t die;
+} raplcap_msr_pd;
+
+#define RAPLCAP_MSR_ZONES_LEN (RAPLCAP_ZONE_PSYS + 1)
+
+typedef struct raplcap_msr_counter {
   double j_last;
   double j_max;
   uint32_t n_overflow;
+} raplcap_msr_counter;
+
+typedef struct raplcap_msr_info {
+  raplcap_msr_pd pd;
   int is_active;
+  // indexed by zone, only the selected zones are used
+  raplcap_msr_counter counters[RAPLCAP_MSR_ZONES_LEN];
 } raplcap_msr_info;
 
 typedef struct energymon_raplcap_msr {
+  // a single context (and its MSR file descriptors) is shared by all zones
   raplcap rc;
-  raplcap_zone zone;
-  uint32_t n_pkg;
-  uint32_t n_die;
+  raplcap_zone zones[RAPLCAP_MSR_ZONES_LEN];
+  uint32_t n_zones;
   uint32_t n_msrs;
   raplcap_msr_info msrs[];
 } energymon_raplcap_msr;
 
+// lowercase for channel names, like the RAPL sysfs domains
+static const char* const RAPLCAP_MSR_ZONE_NAMES[RAPLCAP_MSR_ZONES_LEN] = {
+  [RAPLCAP_ZONE_PACKAGE] = "package",
+  [RAPLCAP_ZONE_CORE] = "core",
+  [RAPLCAP_ZONE_UNCORE] = "uncore",
+  [RAPLCAP_ZONE_DRAM] = "dram",
+  [RAPLCAP_ZONE_PSYS] = "psys",
+};
+
+// topology and counter ranges don't change, so are only discovered once per process
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static raplcap_msr_pd* cache_pds = NULL;
+static uint32_t cache_n_pds = 0;
+// max energy for each zone and instance, where 0 means not yet discovered
+static double* cache_j_max[RAPLCAP_MSR_ZONES_LEN];
+
 static int get_raplcap_zone(raplcap_zone* zone, const char* env_zone) {
-  if (env_zone == NULL || !strcmp(env_zone, "PACKAGE")) {
+  if (!strcmp(env_zone, "PACKAGE")) {
     *zone = RAPLCAP_ZONE_PACKAGE;
   } else if (!strcmp(env_zone, "CORE")) {
     *zone = RAPLCAP_ZONE_CORE;
@@ -57,6 +92,42 @@ static int get_raplcap_zone(raplcap_zone* zone, const char* env_zone) {
   return 0;
 }
 
+static int get_raplcap_zones(energymon_raplcap_msr* state) {
+  raplcap_zone zone;
+  uint32_t i;
+  char* tmp;
+  char* tok;
+  char* saveptr;
+  const char* env_zone = getenv(ENERGYMON_RAPLCAP_MSR_ZONE);
+  if (env_zone == NULL) {
+    state->zones[0] = RAPLCAP_ZONE_PACKAGE;
+    state->n_zones = 1;
+    return 0;
+  }
+  if ((tmp = strdup(env_zone)) == NULL) {
+    perror("energymon_init_raplcap_msr: strdup");
+    return -1;
+  }
+  for (tok = strtok_r(tmp, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+    if (get_raplcap_zone(&zone, tok)) {
+      free(tmp);
+      return -1;
+    }
+    // ignore duplicates so that no zone is counted twice
+    for (i = 0; i < state->n_zones && state->zones[i] != zone; i++);
+    if (i == state->n_zones) {
+      state->zones[state->n_zones++] = zone;
+    }
+  }
+  free(tmp);
+  if (state->n_zones == 0) {
+    fprintf(stderr, "energymon_init_raplcap_msr: No zones in env var: "ENERGYMON_RAPLCAP_MSR_ZONE"=%s\n", env_zone);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
 static int get_active_instances(raplcap_msr_info* msrs, uint32_t n_msrs) {
   uint32_t i;
   char* tmp;
@@ -99,56 +170,117 @@ static int get_active_instances(raplcap_msr_info* msrs, uint32_t n_msrs) {
   return 0;
 }
 
-int energymon_init_raplcap_msr(energymon* em) {
-  if (em == NULL || em->state != NULL) {
-    errno = EINVAL;
-    return -1;
-  }
-
-  int err_save;
-  int supp;
-  uint32_t i;
+/**
+ * Discover all package/die instances, unless already cached.
+ * Packages may have different numbers of die.
+ * Must hold cache_lock.
+ */
+static int get_topology(void) {
+  raplcap_msr_pd* pds = NULL;
+  raplcap_msr_pd* tmp;
+  uint32_t n_pds = 0;
   uint32_t n_pkg;
   uint32_t n_die;
-  uint32_t n_msrs;
-  uint32_t max_die;
   uint32_t pkg;
   uint32_t die;
+  if (cache_pds != NULL) {
+    return 0;
+  }
   if ((n_pkg = raplcap_get_num_packages(NULL)) == 0) {
     perror("raplcap_get_num_packages");
     return -1;
   }
-  // currently only support systems with homogeneous package/die configurations
   for (pkg = 0; pkg < n_pkg; pkg++) {
-    if ((n_die = raplcap_get_num_die(NULL, pkg)) == 0) {
-      perror("raplcap_get_num_die");
+    if ((n_die = raplcap_get_num_die(NULL, pkg)) == 0 ||
+        (tmp = realloc(pds, (n_pds + n_die) * sizeof(raplcap_msr_pd))) == NULL) {
+      perror(n_die == 0 ? "raplcap_get_num_die" : "energymon_init_raplcap_msr: realloc");
+      free(pds);
       return -1;
     }
-    if (pkg == 0) {
-      max_die = n_die;
-    } else if (max_die != n_die) {
-      fprintf(stderr, "energymon_init_raplcap_msr: no support for heterogeneous package/die\n");
-      errno = ENOSYS;
-      return -1;
+    pds = tmp;
+    for (die = 0; die < n_die; die++) {
+      pds[n_pds].pkg = pkg;
+      pds[n_pds++].die = die;
     }
   }
-  n_msrs = n_pkg * n_die;
+  cache_pds = pds;
+  cache_n_pds = n_pds;
+  return 0;
+}
 
-  energymon_raplcap_msr* state = calloc(1, sizeof(energymon_raplcap_msr) + (n_msrs * sizeof(raplcap_msr_info)));
-  if (state == NULL) {
+/**
+ * Check that the zone is supported and get its max energy, unless already cached.
+ * Must hold cache_lock.
+ */
+static int get_energy_counter_max(energymon_raplcap_msr* state, uint32_t i, raplcap_zone zone) {
+  raplcap_msr_counter* c = &state->msrs[i].counters[zone];
+  uint32_t pkg = state->msrs[i].pd.pkg;
+  uint32_t die = state->msrs[i].pd.die;
+  int supp;
+  if (cache_j_max[zone] == NULL) {
+    // failure isn't an error, it only means the value isn't cached
+    cache_j_max[zone] = calloc(state->n_msrs, sizeof(double));
+  }
+  if (cache_j_max[zone] != NULL && cache_j_max[zone][i] > 0) {
+    c->j_max = cache_j_max[zone][i];
+    return 0;
+  }
+  // first check if zone is supported
+  supp = raplcap_pd_is_zone_supported(&state->rc, pkg, die, zone);
+  if (supp < 0) {
+    perror("raplcap_pd_is_zone_supported");
+    return -1;
+  }
+  if (supp == 0) {
+    fprintf(stderr, "energymon_init_raplcap_msr: Unsupported zone: %s\n", RAPLCAP_MSR_ZONE_NAMES[zone]);
+    errno = EINVAL;
+    return -1;
+  }
+  // Note: max energy is specified in a different MSR than the zone's energy counter,
+  // so this call might still work for unsupported zones (which is why we have to check for support first)
+  if ((c->j_max = raplcap_pd_get_energy_counter_max(&state->rc, pkg, die, zone)) < 0) {
+    perror("raplcap_pd_get_energy_counter_max");
+    return -1;
+  }
+  if (cache_j_max[zone] != NULL) {
+    cache_j_max[zone][i] = c->j_max;
+  }
+  return 0;
+}
+
+int energymon_init_raplcap_msr(energymon* em) {
+  if (em == NULL || em->state != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int err_save;
+  int ret;
+  uint32_t i;
+  uint32_t z;
+  energymon_raplcap_msr* state = NULL;
+  pthread_mutex_lock(&cache_lock);
+  if (!(ret = get_topology())) {
+    if ((state = calloc(1, sizeof(energymon_raplcap_msr) + (cache_n_pds * sizeof(raplcap_msr_info)))) == NULL) {
+      ret = -1;
+    } else {
+      state->n_msrs = cache_n_pds;
+      for (i = 0; i < state->n_msrs; i++) {
+        state->msrs[i].pd = cache_pds[i];
+      }
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  if (ret) {
     return -1;
   }
-  state->n_msrs = n_msrs;
-  state->n_pkg = n_pkg;
-  state->n_die = n_die;
 
   if (get_active_instances(state->msrs, state->n_msrs)) {
     free(state);
     return -1;
   }
 
-  const char* env_zone = getenv(ENERGYMON_RAPLCAP_MSR_ZONE);
-  if (get_raplcap_zone(&state->zone, env_zone)) {
+  if (get_raplcap_zones(state)) {
     free(state);
     return -1;
   }
@@ -159,31 +291,16 @@ int energymon_init_raplcap_msr(energymon* em) {
     return -1;
   }
 
-  for (pkg = 0; pkg < state->n_pkg; pkg++) {
-    for (die = 0; die < state->n_die; die++) {
-      i = pkg * die + die;
-      if (!state->msrs[i].is_active) {
-        continue;
-      }
-      // first check if zone is supported
-      supp = raplcap_pd_is_zone_supported(&state->rc, pkg, die, state->zone);
-      if (supp < 0) {
-        perror("raplcap_pd_is_zone_supported");
-        goto fail;
-      }
-      if (supp == 0) {
-        fprintf(stderr, "energymon_init_raplcap_msr: Unsupported zone: %s\n", env_zone == NULL ? "PACKAGE" : env_zone);
-        errno = EINVAL;
-        goto fail;
-      }
-      // Note: max energy is specified in a different MSR than the zone's energy counter,
-      // so this call might still work for unsupported zones (which is why we have to check for support first)
-      if ((state->msrs[i].j_max = raplcap_pd_get_energy_counter_max(&state->rc, pkg, die, state->zone)) < 0) {
-        perror("raplcap_pd_get_energy_counter_max");
-        goto fail;
-      }
+  pthread_mutex_lock(&cache_lock);
+  for (ret = 0, i = 0; i < state->n_msrs && !ret; i++) {
+    for (z = 0; z < state->n_zones && !ret && state->msrs[i].is_active; z++) {
+      ret = get_energy_counter_max(state, i, state->zones[z]);
     }
   }
+  pthread_mutex_unlock(&cache_lock);
+  if (ret) {
+    goto fail;
+  }
 
   em->state = state;
   return 0;
@@ -198,35 +315,68 @@ fail:
   return -1;
 }
 
+/**
+ * Returns 0 on error (check errno), otherwise the instance's energy for the zone.
+ */
+static uint64_t read_instance(energymon_raplcap_msr* state, raplcap_msr_info* m, raplcap_zone zone) {
+  raplcap_msr_counter* c = &m->counters[zone];
+  double j;
+  if ((j = raplcap_pd_get_energy_counter(&state->rc, m->pd.pkg, m->pd.die, zone)) < 0) {
+    return 0;
+  }
+  if (j < c->j_last) {
+    c->n_overflow++;
+  }
+  c->j_last = j;
+  return (uint64_t) ((j + c->n_overflow * c->j_max) * 1000000.0);
+}
+
 uint64_t energymon_read_total_raplcap_msr(const energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
     return 0;
   }
-  uint32_t pkg;
-  uint32_t die;
   uint32_t i;
-  double j;
+  uint32_t z;
   uint64_t total = 0;
   energymon_raplcap_msr* state = (energymon_raplcap_msr*) em->state;
-  for (errno = 0, pkg = 0; pkg < state->n_pkg && !errno; pkg++) {
-    for (die = 0; die < state->n_die && !errno; die++) {
-      i = pkg * die + die;
-      if (!state->msrs[i].is_active) {
-        continue;
-      }
-      if ((j = raplcap_pd_get_energy_counter(&state->rc, pkg, die, state->zone)) >= 0) {
-        if (j < state->msrs[i].j_last) {
-          state->msrs[i].n_overflow++;
-        }
-        state->msrs[i].j_last = j;
-        total += (uint64_t) ((j + state->msrs[i].n_overflow * state->msrs[i].j_max) * 1000000.0);
-      }
+  for (errno = 0, i = 0; i < state->n_msrs && !errno; i++) {
+    for (z = 0; z < state->n_zones && !errno && state->msrs[i].is_active; z++) {
+      total += read_instance(state, &state->msrs[i], state->zones[z]);
     }
   }
   return errno ? 0 : total;
 }
 
+size_t energymon_read_channels_raplcap_msr(const energymon* em, energymon_channel* channels, size_t n) {
+  if (em == NULL || em->state == NULL || (channels == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_raplcap_msr* state = (energymon_raplcap_msr*) em->state;
+  size_t n_active = 0;
+  uint32_t i;
+  uint32_t z;
+  for (i = 0; i < state->n_msrs; i++) {
+    n_active += (size_t) state->msrs[i].is_active * state->n_zones;
+  }
+  if (n == 0) {
+    return n_active;
+  }
+  if (n < n_active) {
+    errno = ENOBUFS;
+    return 0;
+  }
+  for (errno = 0, n = 0, i = 0; i < state->n_msrs && !errno; i++) {
+    for (z = 0; z < state->n_zones && !errno && state->msrs[i].is_active; z++, n++) {
+      channels[n].energy_uj = read_instance(state, &state->msrs[i], state->zones[z]);
+      snprintf(channels[n].name, sizeof(channels[n].name), "pkg-%"PRIu32":die-%"PRIu32":%s",
+               state->msrs[i].pd.pkg, state->msrs[i].pd.die, RAPLCAP_MSR_ZONE_NAMES[state->zones[z]]);
+    }
+  }
+  return errno ? 0 : n;
+}
+
 int energymon_finish_raplcap_msr(energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
@@ -263,17 +413,13 @@ uint64_t energymon_get_precision_raplcap_msr(const energymon* em) {
   energymon_raplcap_msr* state = em->state;
   double j;
   double max = 0;
-  uint32_t pkg;
-  uint32_t die;
   uint32_t i;
-  for (pkg = 0; pkg < state->n_pkg; pkg++) {
-    for (die = 0; die < state->n_die; die++) {
-      i = pkg * die + die;
-      if (!state->msrs[i].is_active) {
-        continue;
-      }
-      // precision limited by the largest units (they should all be the same though)
-      if ((j = raplcap_msr_pd_get_energy_units(&state->rc, pkg, die, state->zone)) > max) {
+  uint32_t z;
+  for (i = 0; i < state->n_msrs; i++) {
+    for (z = 0; z < state->n_zones && state->msrs[i].is_active; z++) {
+      // precision limited by the largest units (e.g., DRAM units may differ from other zones)
+      if ((j = raplcap_msr_pd_get_energy_units(&state->rc, state->msrs[i].pd.pkg, state->msrs[i].pd.die,
+                                               state->zones[z])) > max) {
         max = j;
       }
     }
@@ -300,3 +446,13 @@ int energymon_get_raplcap_msr(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_raplcap_msr(energymon_ext* ext) {
+  if (energymon_get_ext_fallback(ext)) {
+    return -1;
+  }
+  if (ENERGYMON_EXT_HAS(ext, fread_channels)) {
+    ext->fread_channels = &energymon_read_channels_raplcap_msr;
+  }
+  return 0;
+}
@@ -1,17 +1,20 @@
 /**
  * Read energy from Intel RAPL using the raplcap-msr library.
  *
- * To specify which RAPL zone to use, set the environment variable ENERGYMON_RAPLCAP_MSR_ZONE to one of:
+ * To specify which RAPL zones to use, set the environment variable ENERGYMON_RAPLCAP_MSR_ZONE to a comma-delimited
+ * list of:
  *   "PACKAGE" (default)
  *   "CORE"
  *   "UNCORE"
  *   "DRAM"
  *   "PSYS" or "PLATFORM"
+ * The total is the sum across zones, and each instance's zone is reported as a channel.
  *
  * By default, all RAPL instances are read. To configure for only specific instances, set the
  * ENERGYMON_RAPLCAP_MSR_INSTANCES environment variable with a comma-delimited list of IDs, e.g., on a quad-socket
  * system, to use only instances (sockets) 0 and 2 (and ignore 1 and 3):
  *   export ENERGYMON_RAPLCAP_MSR_INSTANCES=0,2
+ * Instance IDs are numbered contiguously by package, then die, even if packages have different numbers of die.
  *
  * @author Connor Imes
  * @date 2018-05-19
@@ -27,7 +30,7 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
-/* Environment variable for specifying the zone to use */
+/* Environment variable for specifying the zones to use (comma-delimited) */
 #define ENERGYMON_RAPLCAP_MSR_ZONE "ENERGYMON_RAPLCAP_MSR_ZONE"
 /* Environment variable for specifying the RAPL instances (e.g., sockets) to use */
 #define ENERGYMON_RAPLCAP_MSR_INSTANCES "ENERGYMON_RAPLCAP_MSR_INSTANCES"
@@ -48,6 +51,10 @@ int energymon_is_exclusive_raplcap_msr(void);
 
 int energymon_get_raplcap_msr(energymon* em);
 
+size_t energymon_read_channels_raplcap_msr(const energymon* em, energymon_channel* channels, size_t n);
+
+int energymon_get_ext_raplcap_msr(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
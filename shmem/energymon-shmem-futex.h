@@ -0,0 +1,44 @@
+/**
+ * Internal futex support for waking and waiting on shared memory samples.
+ * Includers must define _GNU_SOURCE, otherwise futexes are not used.
+ */
+#ifndef _ENERGYMON_SHMEM_FUTEX_H_
+#define _ENERGYMON_SHMEM_FUTEX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include "energymon-shmem.h"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(SYS_futex)
+#define ENERGYMON_SHMEM_FUTEX
+#endif
+#endif
+
+#pragma GCC visibility push(hidden)
+
+/**
+ * The futex word that consumers wait on for new samples: the low-order 32 bits
+ * of n_samples.
+ */
+static inline volatile uint32_t* energymon_shmem_futex_word(const energymon_shmem* ems) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return (volatile uint32_t*) &ems->n_samples + 1;
+#else
+  return (volatile uint32_t*) &ems->n_samples;
+#endif
+}
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
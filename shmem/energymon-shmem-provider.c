@@ -5,6 +5,7 @@
  * @date 2016-02-18
  */
 #define _GNU_SOURCE
+#include <dlfcn.h>
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -12,29 +13,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
-#include <time.h>
+#include <sys/stat.h>
 #include "energymon.h"
 #include "energymon-get.h"
 #include "energymon-shmem.h"
+#include "energymon-time-util.h"
 
 #ifndef ENERGYMON_UTIL_PREFIX
 #error Must set ENERGYMON_UTIL_PREFIX
 #endif
 
+typedef struct provider_source {
+  energymon em;
+  // the dlopen handle, or NULL for the built-in implementation
+  void* lib;
+  energymon_shmem* ems;
+  uint64_t energy_uj;
+  int ok;
+} provider_source;
+
 static volatile int running = 1;
-static energymon_shmem* ems;
+// either an energymon_shmem or an energymon_shmem_table
+static void* shm;
+static size_t shm_len;
 static const char* key_dir = NULL;
 static int key_proj_id = -1;
 static int shm_id;
+static const char* shm_name = NULL;
+static const char** source_specs;
+static size_t n_source_specs = 0;
 
-static const char short_options[] = "hd:i:";
+static const char short_options[] = "hd:i:n:s:";
 static const struct option long_options[] = {
   {"help",      no_argument,       NULL, 'h'},
   {"dir",       required_argument, NULL, 'd'},
   {"id",        required_argument, NULL, 'i'},
+  {"name",      required_argument, NULL, 'n'},
+  {"source",    required_argument, NULL, 's'},
   {0, 0, 0, 0}
 };
 
@@ -50,11 +71,24 @@ static void print_usage(int exit_code) {
           "running before the energymon context is initialized. To specify path and id\n"
           "values for libenergymon-shmem, set the ENERGYMON_SHMEM_DIR and\n"
           "ENERGYMON_SHMEM_ID environment variables, respectively.\n\n"
+          "Alternatively, use POSIX shared memory by specifying a name, as required by\n"
+          "shm_open(3), in which case path and id are ignored. To specify the name for\n"
+          "libenergymon-shmem, set the ENERGYMON_SHMEM_NAME environment variable.\n\n"
+          "Additional EnergyMon implementations may be loaded from shared libraries, in\n"
+          "which case a table is published with this provider's implementation at index\n"
+          "0, followed by the others in the order specified. All implementations are\n"
+          "sampled together. To specify the table index for libenergymon-shmem, set the\n"
+          "ENERGYMON_SHMEM_INDEX environment variable.\n\n"
           "Options:\n"
           "  -h, --help               Print this message and exit\n"
           "  -d, --dir=PATH           The shared memory path (default = \"%s\")\n"
           "  -i, --id=ID              The shared memory identifier (default = %d)\n"
-          "                           ID must be in range [1, 255]\n",
+          "                           ID must be in range [1, 255]\n"
+          "  -n, --name=NAME          The POSIX shared memory name, e.g., \"/energymon\"\n"
+          "  -s, --source=LIB:FUNC    Also publish the EnergyMon implementation from\n"
+          "                           shared library LIB with getter function FUNC,\n"
+          "                           e.g., \"libenergymon-rapl.so:energymon_get_rapl\"\n"
+          "                           May be specified multiple times\n",
           ENERGYMON_SHMEM_DIR_DEFAULT, ENERGYMON_SHMEM_ID_DEFAULT);
   exit(exit_code);
 }
@@ -80,12 +114,21 @@ static void parse_args(int argc, char** argv) {
         key_proj_id = atoi(optarg);
         enforce_key_proj_id();
         break;
+      case 'n':
+        shm_name = optarg;
+        break;
+      case 's':
+        source_specs[n_source_specs++] = optarg;
+        break;
       case '?':
       default:
         print_usage(EINVAL);
         break;
     }
   }
+  if (shm_name == NULL) {
+    shm_name = getenv(ENERGYMON_SHMEM_NAME);
+  }
   if (key_dir == NULL) {
     key_dir = getenv(ENERGYMON_SHMEM_DIR);
     if (key_dir == NULL) {
@@ -123,8 +166,19 @@ static void shandle(int sig) {
 }
 
 static int cleanup_shmem(void) {
+  if (shm_name != NULL) {
+    if (shm != NULL && munmap(shm, shm_len)) {
+      perror("munmap");
+      return -errno;
+    }
+    if (shm_unlink(shm_name)) {
+      perror("shm_unlink");
+      return -errno;
+    }
+    return 0;
+  }
   // detach shared memory
-  if (shmdt(ems)) {
+  if (shm != NULL && shmdt(shm)) {
     perror("shmdt");
     return -errno;
   }
@@ -136,63 +190,228 @@ static int cleanup_shmem(void) {
   return 0;
 }
 
+static int create_shmem_posix(void) {
+  // round up to whole pages, the granularity of the mapping
+  long page_size = sysconf(_SC_PAGESIZE);
+  int fd;
+  int err_save;
+  if (page_size > 0) {
+    shm_len = ((shm_len + (size_t) page_size - 1) / (size_t) page_size) * (size_t) page_size;
+  }
+  if ((fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0 && errno == EEXIST) {
+    // probably leaked by a provider that was killed before it could cleanup - replace it
+    fprintf(stderr, "Replacing existing shared memory object: %s\n", shm_name);
+    if (shm_unlink(shm_name) && errno != ENOENT) {
+      perror("shm_unlink");
+      return -1;
+    }
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if (fd < 0) {
+    perror("shm_open");
+    return -1;
+  }
+  if (ftruncate(fd, (off_t) shm_len)) {
+    perror("ftruncate");
+    goto fail;
+  }
+  if ((shm = mmap(NULL, shm_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    shm = NULL;
+    perror("mmap");
+    goto fail;
+  }
+  close(fd);
+  return 0;
+fail:
+  err_save = errno;
+  close(fd);
+  shm_unlink(shm_name);
+  errno = err_save;
+  return -1;
+}
+
+static int create_shmem_sysv(void) {
+  key_t mem_key = ftok(key_dir, key_proj_id);
+  shm_id = shmget(mem_key, shm_len, 0644 | IPC_CREAT | IPC_EXCL);
+  if (shm_id < 0) {
+    perror("shmget");
+    return -1;
+  }
+  shm = shmat(shm_id, NULL, 0);
+  if (shm == (void*) -1) {
+    shm = NULL;
+    perror("shmat");
+    cleanup_shmem();
+    return -1;
+  }
+  return 0;
+}
+
+static int get_dl_source(const char* spec, provider_source* src) {
+  int (*getter)(energymon*);
+  char* path;
+  const char* func = strrchr(spec, ':');
+  if (func == NULL || func == spec || func[1] == '\0') {
+    fprintf(stderr, "Invalid source, expected LIB:FUNC: %s\n", spec);
+    errno = EINVAL;
+    return -1;
+  }
+  if ((path = strndup(spec, (size_t) (func - spec))) == NULL) {
+    perror("strndup");
+    return -1;
+  }
+  // keep symbols local, implementations may use the same function names
+  src->lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  free(path);
+  if (src->lib == NULL) {
+    fprintf(stderr, "dlopen: %s\n", dlerror());
+    errno = ENOENT;
+    return -1;
+  }
+  *(void**) (&getter) = dlsym(src->lib, func + 1);
+  if (getter == NULL) {
+    fprintf(stderr, "dlsym: %s\n", dlerror());
+    errno = ENOENT;
+    return -1;
+  }
+  return getter(&src->em);
+}
+
+static void cleanup_sources(provider_source* srcs, size_t n_init, size_t n) {
+  size_t i;
+  for (i = 0; i < n_init; i++) {
+    if (srcs[i].em.ffinish(&srcs[i].em)) {
+      perror("energymon:ffinish");
+    }
+  }
+  for (i = 0; i < n; i++) {
+    if (srcs[i].lib != NULL) {
+      dlclose(srcs[i].lib);
+    }
+  }
+  free(srcs);
+}
+
 int main(int argc, char** argv) {
-  energymon em;
-  struct timespec ts;
-  key_t mem_key;
+  provider_source* srcs;
+  energymon_shmem_table* table = NULL;
+  energymon_periodic period;
+  uint64_t now_ns;
+  uint64_t interval_us = 0;
+  uint64_t src_interval_us;
+  size_t n;
+  size_t i;
 
-  // register the signal handler
+  // register the signal handlers - SIGTERM is common in containers
   signal(SIGINT, shandle);
+  signal(SIGTERM, shandle);
 
+  if ((source_specs = malloc((size_t) argc * sizeof(const char*))) == NULL) {
+    perror("malloc");
+    return -errno;
+  }
   parse_args(argc, argv);
-
-  // get the shared memory
-  mem_key = ftok(key_dir, key_proj_id);
-  shm_id = shmget(mem_key, sizeof(energymon_shmem), 0644 | IPC_CREAT | IPC_EXCL);
-  if (shm_id < 0) {
-    perror("shmget");
+  n = 1 + n_source_specs;
+  if ((srcs = calloc(n, sizeof(provider_source))) == NULL) {
+    perror("calloc");
+    free(source_specs);
     return -errno;
   }
-  ems = (energymon_shmem*) shmat(shm_id, NULL, 0);
-  if (ems == (energymon_shmem*) -1) {
-    perror("shmat");
-    cleanup_shmem();
+
+  // get the energy monitors
+  errno = 0;
+  if (energymon_get(&srcs[0].em)) {
+    cleanup_sources(srcs, 0, n);
+    free(source_specs);
     return -errno;
   }
+  for (i = 1; i < n; i++) {
+    if (get_dl_source(source_specs[i - 1], &srcs[i])) {
+      cleanup_sources(srcs, 0, n);
+      free(source_specs);
+      return -errno;
+    }
+  }
+  free(source_specs);
 
-  // get the energy monitor
-  if (energymon_get(&em)) {
-    cleanup_shmem();
+  // get the shared memory
+  shm_len = n > 1 ? offsetof(energymon_shmem_table, entries) + n * sizeof(energymon_shmem_table_entry) :
+                    sizeof(energymon_shmem);
+  if (shm_name != NULL ? create_shmem_posix() : create_shmem_sysv()) {
+    cleanup_sources(srcs, 0, n);
     return -errno;
   }
+  if (n > 1) {
+    table = shm;
+    for (i = 0; i < n; i++) {
+      srcs[i].ems = &table->entries[i].shmem;
+      srcs[i].em.fsource(table->entries[i].source, sizeof(table->entries[i].source));
+    }
+  } else {
+    srcs[0].ems = shm;
+  }
 
-  // initialize the energy monitor
-  if (em.finit(&em)) {
-    perror("energymon:finit");
+  // initialize the energy monitors
+  for (i = 0; i < n; i++) {
+    if (srcs[i].em.finit(&srcs[i].em)) {
+      perror("energymon:finit");
+      cleanup_sources(srcs, i, n);
+      cleanup_shmem();
+      return -errno;
+    }
+  }
+
+  // store the version, interval, and precision in shared memory
+  for (i = 0; i < n; i++) {
+    src_interval_us = srcs[i].em.finterval(&srcs[i].em);
+    energymon_shmem_write_begin(srcs[i].ems);
+    srcs[i].ems->version = ENERGYMON_SHMEM_VERSION;
+    srcs[i].ems->interval_us = src_interval_us;
+    srcs[i].ems->precision_uj = srcs[i].em.fprecision(&srcs[i].em);
+    energymon_shmem_write_end(srcs[i].ems);
+    // sample at the fastest rate any implementation supports
+    if (src_interval_us > 0 && (interval_us == 0 || src_interval_us < interval_us)) {
+      interval_us = src_interval_us;
+    }
+  }
+  if (table != NULL) {
+    table->count = n;
+    __atomic_store_n(&table->version, ENERGYMON_SHMEM_TABLE_VERSION, __ATOMIC_RELEASE);
+  }
+  if (energymon_periodic_init(&period, interval_us)) {
+    perror("energymon_periodic_init");
+    cleanup_sources(srcs, n, n);
     cleanup_shmem();
     return -errno;
   }
-  
-  // store the interval in shared memory
-  ems->interval_us = em.finterval(&em);
-  ts.tv_sec = (time_t) (ems->interval_us / (uint64_t) 1000000);
-  ts.tv_nsec = (long) ((ems->interval_us % (uint64_t) 1000000) * (uint64_t) 1000);
-
-  // store the precision in shared memory
-  ems->precision_uj = em.fprecision(&em);
 
   while (running) {
-    // update the energy in shared memory
-    ems->energy_uj = em.fread(&em);
-    nanosleep(&ts, NULL);
+    // read all energy monitors, then update the shared memory with one timestamp
+    for (i = 0; i < n; i++) {
+      errno = 0;
+      srcs[i].energy_uj = srcs[i].em.fread(&srcs[i].em);
+      srcs[i].ok = srcs[i].energy_uj || !errno;
+    }
+    now_ns = energymon_gettime_ns();
+    for (i = 0; i < n; i++) {
+      energymon_shmem_write_begin(srcs[i].ems);
+      if (srcs[i].ok) {
+        energymon_shmem_write_sample(srcs[i].ems, now_ns, srcs[i].energy_uj);
+      }
+      srcs[i].ems->heartbeat_ns = now_ns;
+      energymon_shmem_write_end(srcs[i].ems);
+    }
+    // sample on absolute deadlines so the read cost doesn't add to the period
+    energymon_periodic_wait(&period, &running);
+  }
+  if (period.overruns > 0) {
+    // samples were late, e.g., reads took longer than the interval or the process wasn't scheduled in time
+    fprintf(stderr, "Missed %"PRIu64" sample deadline(s)\n", period.overruns);
   }
 
   errno = 0;
   // cleanup
-  if (em.ffinish(&em)) {
-    perror("energymon:ffinish");
-  }
-
+  cleanup_sources(srcs, n, n);
   cleanup_shmem();
 
   return errno;
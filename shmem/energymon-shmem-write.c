@@ -0,0 +1,20 @@
+/**
+ * Provider-side shared memory functions.
+ * Kept separate from the consumer implementation so that providers (and static
+ * libraries) can include it without the rest of energymon-shmem.
+ *
+ * @date 2026-10-16
+ */
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include "energymon-shmem.h"
+#include "energymon-shmem-futex.h"
+
+void energymon_shmem_write_end(energymon_shmem* ems) {
+  __atomic_store_n(&ems->seq, ems->seq + 1, __ATOMIC_RELEASE);
+#if defined(ENERGYMON_SHMEM_FUTEX)
+  // consumers map the segment read-only and can't register as waiters, so always wake - the kernel returns quickly
+  // if nobody is waiting; not FUTEX_WAKE_PRIVATE since waiters are in other processes
+  syscall(SYS_futex, energymon_shmem_futex_word(ems), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+}
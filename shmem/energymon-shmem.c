@@ -8,11 +8,21 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-shmem.h"
+#include "energymon-shmem-futex.h"
+#include "energymon-time-util.h"
 #include "energymon-util.h"
 
 #ifdef ENERGYMON_DEFAULT
@@ -20,20 +30,35 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_shmem(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_shmem(ext);
+}
 #endif
 
-int energymon_init_shmem(energymon* em) {
-  if (em == NULL || em->state != NULL) {
-    errno = EINVAL;
-    return -1;
-  }
+typedef struct energymon_shmem_state {
+  energymon_shmem* ems;
+  // the provider's layout version, 0 if unversioned (not seqlock-protected)
+  int version;
+  // the attached segment, which may be a table that contains ems
+  void* base;
+  size_t len;
+  int posix;
+} energymon_shmem_state;
+
+// the shared memory size of each layout, indexed by version
+static const size_t SHMEM_SIZES[] = {
+  ENERGYMON_SHMEM_SIZE_UNVERSIONED,
+  ENERGYMON_SHMEM_SIZE_V1,
+  sizeof(energymon_shmem),
+};
 
+static int shmem_attach_sysv(energymon_shmem_state* state) {
   const char* key_dir;
   int key_proj_id = ENERGYMON_SHMEM_ID_DEFAULT;
   const char* key_proj_id_env;
   key_t mem_key;
   int shm_id;
-  energymon_shmem* ems;
+  struct shmid_ds ds;
 
   // get desired configuration from environment
   key_dir = getenv(ENERGYMON_SHMEM_DIR);
@@ -45,29 +70,306 @@ int energymon_init_shmem(energymon* em) {
     key_proj_id = atoi(key_proj_id_env);
   }
 
-  // attach to shared memory
+  // attach to shared memory - the size is determined by the provider
   mem_key = ftok(key_dir, key_proj_id);
-  shm_id = shmget(mem_key, sizeof(energymon_shmem), 0444);
+  shm_id = shmget(mem_key, 0, 0444);
   if (shm_id < 0) {
     // among other reasons, fails if nobody is providing this shared memory
     return -1;
   }
-  ems = (energymon_shmem*) shmat(shm_id, NULL, SHM_RDONLY);
-  if (ems == (energymon_shmem*) -1) {
+  if (shmctl(shm_id, IPC_STAT, &ds)) {
+    return -1;
+  }
+  state->len = ds.shm_segsz;
+  state->base = shmat(shm_id, NULL, SHM_RDONLY);
+  if (state->base == (void*) -1) {
+    state->base = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int shmem_attach_posix(energymon_shmem_state* state, const char* name) {
+  struct stat st;
+  int err_save;
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    // among other reasons, fails if nobody is providing this shared memory
+    return -1;
+  }
+  if (fstat(fd, &st)) {
+    err_save = errno;
+    close(fd);
+    errno = err_save;
+    return -1;
+  }
+  if (st.st_size == 0) {
+    // the provider created the object but hasn't sized it yet
+    close(fd);
+    errno = EAGAIN;
+    return -1;
+  }
+  state->posix = 1;
+  state->len = (size_t) st.st_size;
+  state->base = mmap(NULL, state->len, PROT_READ, MAP_SHARED, fd, 0);
+  err_save = errno;
+  close(fd);
+  errno = err_save;
+  if (state->base == MAP_FAILED) {
+    state->base = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int shmem_find_layout(energymon_shmem_state* state, const char* index_env) {
+  const energymon_shmem_table* table = state->base;
+  unsigned long index;
+  uint64_t version;
+  char* end;
+  if (index_env == NULL) {
+    // determine the layout version from the segment size
+    if (state->len < SHMEM_SIZES[0]) {
+      errno = EINVAL;
+      return -1;
+    }
+    for (state->version = ENERGYMON_SHMEM_VERSION; state->len < SHMEM_SIZES[state->version];
+         state->version--);
+    state->ems = state->base;
+    if (state->version == 0) {
+      // unversioned providers don't have a version field
+      return 0;
+    }
+    version = __atomic_load_n(&state->ems->version, __ATOMIC_ACQUIRE);
+    if (version == 0) {
+      // the provider hasn't finished initializing yet (it may even be a table)
+      errno = EAGAIN;
+      return -1;
+    }
+    if (version == ENERGYMON_SHMEM_TABLE_VERSION) {
+      // an index is required
+      errno = EINVAL;
+      return -1;
+    }
+    if (version < (uint64_t) state->version) {
+      // the segment is larger than the provider's layout requires, e.g., rounded up to a page
+      state->version = (int) version;
+    } else if (version > (uint64_t) state->version && state->version < ENERGYMON_SHMEM_VERSION) {
+      // too small for the provider's layout - newer versions only append fields, so those are readable if the
+      // segment is at least as large as the newest layout we know about
+      errno = ENOTSUP;
+      return -1;
+    }
+    return 0;
+  }
+  errno = 0;
+  index = strtoul(index_env, &end, 0);
+  if (errno || end == index_env || *end != '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+  if (state->len < offsetof(energymon_shmem_table, entries)) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (__atomic_load_n(&table->version, __ATOMIC_ACQUIRE)) {
+    case 0:
+      // the provider hasn't finished initializing the table yet
+      errno = EAGAIN;
+      return -1;
+    case ENERGYMON_SHMEM_TABLE_VERSION:
+      break;
+    default:
+      errno = ENOTSUP;
+      return -1;
+  }
+  if (index >= table->count ||
+      state->len < offsetof(energymon_shmem_table, entries) +
+                   (index + 1) * sizeof(energymon_shmem_table_entry)) {
+    errno = ERANGE;
+    return -1;
+  }
+  // table entries always use the version 2 layout
+  state->version = 2;
+  state->ems = (energymon_shmem*) &table->entries[index].shmem;
+  return 0;
+}
+
+static int shmem_detach(energymon_shmem_state* state) {
+  return state->posix ? munmap(state->base, state->len) : shmdt(state->base);
+}
+
+int energymon_init_shmem(energymon* em) {
+  if (em == NULL || em->state != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int err_save;
+  const char* name = getenv(ENERGYMON_SHMEM_NAME);
+  energymon_shmem_state* state = calloc(1, sizeof(energymon_shmem_state));
+  if (state == NULL) {
+    return -1;
+  }
+  if (name == NULL ? shmem_attach_sysv(state) : shmem_attach_posix(state, name)) {
+    free(state);
+    return -1;
+  }
+  if (shmem_find_layout(state, getenv(ENERGYMON_SHMEM_INDEX))) {
+    err_save = errno;
+    shmem_detach(state);
+    free(state);
+    errno = err_save;
     return -1;
   }
 
-  em->state = ems;
+  em->state = state;
   return 0;
 }
 
+static inline uint64_t shmem_read_u64(const energymon_shmem_state* state,
+                                      const volatile uint64_t* field) {
+  uint64_t seq;
+  uint64_t val;
+  if (!state->version) {
+    return *field;
+  }
+  do {
+    if (energymon_shmem_read_begin(state->ems, &seq)) {
+      return 0;
+    }
+    val = *field;
+  } while (energymon_shmem_read_retry(state->ems, seq));
+  return val;
+}
+
 uint64_t energymon_read_total_shmem(const energymon* em) {
   if (em == NULL || em->state == NULL) {
     errno = EINVAL;
     return 0;
   }
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
   errno = 0;
-  return ((energymon_shmem*) em->state)->energy_uj;
+  return shmem_read_u64(state, &state->ems->energy_uj);
+}
+
+size_t energymon_read_samples_shmem(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
+  const energymon_shmem* ems = state->ems;
+  uint64_t seq;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (state->version) {
+      // use the provider's timestamp, which is when the value was actually sampled
+      do {
+        if (energymon_shmem_read_begin(ems, &seq)) {
+          return i;
+        }
+        samples[i].time_ns = ems->time_ns;
+        samples[i].energy_uj = ems->energy_uj;
+      } while (energymon_shmem_read_retry(ems, seq));
+    } else {
+      samples[i].time_ns = energymon_gettime_ns();
+      samples[i].energy_uj = ems->energy_uj;
+    }
+  }
+  errno = 0;
+  return n;
+}
+
+size_t energymon_read_history_shmem(const energymon* em, uint64_t* cursor,
+                                    energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || cursor == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
+  const energymon_shmem* ems = state->ems;
+  uint64_t head;
+  uint64_t start;
+  uint64_t oldest;
+  size_t count;
+  size_t lost;
+  size_t i;
+  if (state->version < 2) {
+    errno = ENOTSUP;
+    return 0;
+  }
+  head = __atomic_load_n(&ems->n_samples, __ATOMIC_ACQUIRE);
+  if (n == 0) {
+    *cursor = head;
+    errno = 0;
+    return 0;
+  }
+  // the provider may be writing over the oldest slot, so it's never available
+  start = *cursor > head ? head : *cursor;
+  if (head - start > ENERGYMON_SHMEM_RING_LEN - 1) {
+    start = head - (ENERGYMON_SHMEM_RING_LEN - 1);
+  }
+  count = head - start < n ? (size_t) (head - start) : n;
+  for (i = 0; i < count; i++) {
+    samples[i].time_ns = ems->ring[(start + i) % ENERGYMON_SHMEM_RING_LEN].time_ns;
+    samples[i].energy_uj = ems->ring[(start + i) % ENERGYMON_SHMEM_RING_LEN].energy_uj;
+  }
+  // discard samples that may have been overwritten while copying
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  head = __atomic_load_n(&ems->n_samples, __ATOMIC_RELAXED);
+  oldest = head > ENERGYMON_SHMEM_RING_LEN - 1 ? head - (ENERGYMON_SHMEM_RING_LEN - 1) : 0;
+  lost = oldest <= start ? 0 : (oldest - start < count ? (size_t) (oldest - start) : count);
+  if (lost > 0) {
+    memmove(samples, samples + lost, (count - lost) * sizeof(energymon_sample));
+  }
+  *cursor = start + count;
+  errno = 0;
+  return count - lost;
+}
+
+int energymon_wait_shmem(const energymon* em, uint64_t cursor, uint64_t timeout_us) {
+  if (em == NULL || em->state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
+  if (state->version < 2) {
+    errno = ENOTSUP;
+    return -1;
+  }
+#if defined(ENERGYMON_SHMEM_FUTEX)
+  const energymon_shmem* ems = state->ems;
+  const uint64_t deadline_ns = energymon_gettime_ns() + timeout_us * 1000;
+  struct timespec ts;
+  uint64_t n;
+  uint64_t now_ns;
+  for (;;) {
+    n = __atomic_load_n(&ems->n_samples, __ATOMIC_ACQUIRE);
+    if (n > cursor) {
+      return 0;
+    }
+    if (timeout_us > 0) {
+      if ((now_ns = energymon_gettime_ns()) >= deadline_ns) {
+        errno = ETIMEDOUT;
+        return -1;
+      }
+      ts.tv_sec = (time_t) ((deadline_ns - now_ns) / 1000000000);
+      ts.tv_nsec = (long) ((deadline_ns - now_ns) % 1000000000);
+    }
+    // returns immediately (EAGAIN) if a sample was published since n was read
+    if (syscall(SYS_futex, energymon_shmem_futex_word(ems), FUTEX_WAIT, (uint32_t) n,
+                timeout_us > 0 ? &ts : NULL, NULL, 0) &&
+        errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+      return -1;
+    }
+  }
+#else
+  (void) cursor;
+  (void) timeout_us;
+  errno = ENOSYS;
+  return -1;
+#endif
 }
 
 int energymon_finish_shmem(energymon* em) {
@@ -75,10 +377,12 @@ int energymon_finish_shmem(energymon* em) {
     errno = EINVAL;
     return -1;
   }
-  energymon_shmem* state = (energymon_shmem*) em->state;
+  energymon_shmem_state* state = (energymon_shmem_state*) em->state;
   em->state = NULL;
   // detach from shared memory
-  return shmdt(state);
+  int ret = shmem_detach(state);
+  free(state);
+  return ret;
 }
 
 char* energymon_get_source_shmem(char* buffer, size_t n) {
@@ -90,7 +394,8 @@ uint64_t energymon_get_interval_shmem(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
-  return ((energymon_shmem*) em->state)->interval_us;
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
+  return shmem_read_u64(state, &state->ems->interval_us);
 }
 
 uint64_t energymon_get_precision_shmem(const energymon* em) {
@@ -98,7 +403,8 @@ uint64_t energymon_get_precision_shmem(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
-  return ((energymon_shmem*) em->state)->precision_uj;
+  const energymon_shmem_state* state = (energymon_shmem_state*) em->state;
+  return shmem_read_u64(state, &state->ems->precision_uj);
 }
 
 int energymon_is_exclusive_shmem(void) {
@@ -120,3 +426,7 @@ int energymon_get_shmem(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_shmem(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_shmem);
+}
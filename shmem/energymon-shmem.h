@@ -11,7 +11,9 @@
 extern "C" {
 #endif
 
+#include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <stddef.h>
 #include "energymon.h"
 
@@ -19,13 +21,163 @@ extern "C" {
 #define ENERGYMON_SHMEM_DIR_DEFAULT "."
 #define ENERGYMON_SHMEM_ID "ENERGYMON_SHMEM_ID"
 #define ENERGYMON_SHMEM_ID_DEFAULT 1
+#define ENERGYMON_SHMEM_NAME "ENERGYMON_SHMEM_NAME"
+#define ENERGYMON_SHMEM_INDEX "ENERGYMON_SHMEM_INDEX"
 
+#define ENERGYMON_SHMEM_VERSION 2
+
+// the number of samples retained in the history ring (version 2)
+#define ENERGYMON_SHMEM_RING_LEN 1024
+
+/**
+ * The shared memory layout.
+ *
+ * Unversioned providers only create and write the first three fields.
+ * Versioned providers protect all fields with a seqlock: the seq field is odd
+ * while the provider is writing, and readers retry if it was odd or changed
+ * while they were reading, so consistent values are read without any locks or
+ * system calls.
+ * Use the energymon_shmem_write_* and energymon_shmem_read_* functions below.
+ * New fields may be appended in future versions.
+ *
+ * Timestamps are from the system's monotonic clock (CLOCK_MONOTONIC on Linux).
+ */
 typedef struct energymon_shmem {
   volatile uint64_t interval_us;
   volatile uint64_t precision_uj;
   volatile uint64_t energy_uj;
+  // Version 1
+  volatile uint64_t seq;
+  volatile uint64_t version;
+  // time at which energy_uj was sampled, in nanoseconds
+  volatile uint64_t time_ns;
+  // the number of samples published
+  volatile uint64_t n_samples;
+  // time at which the provider last updated the segment, in nanoseconds;
+  // updated even if a sample could not be published, e.g., on read failure
+  volatile uint64_t heartbeat_ns;
+  // Version 2
+  // the most recent samples, sample i is at index i % ENERGYMON_SHMEM_RING_LEN;
+  // not protected by seq, readers instead validate against n_samples
+  volatile energymon_sample ring[ENERGYMON_SHMEM_RING_LEN];
 } energymon_shmem;
 
+/**
+ * The shared memory size created by unversioned providers.
+ */
+#define ENERGYMON_SHMEM_SIZE_UNVERSIONED offsetof(energymon_shmem, seq)
+
+/**
+ * The shared memory size created by version 1 providers.
+ */
+#define ENERGYMON_SHMEM_SIZE_V1 offsetof(energymon_shmem, ring)
+
+/**
+ * Begin updating a versioned shared memory segment (single provider only).
+ */
+static inline void energymon_shmem_write_begin(energymon_shmem* ems) {
+  __atomic_store_n(&ems->seq, ems->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finish updating a versioned shared memory segment.
+ * Wakes any consumers waiting in energymon_wait_shmem (on Linux).
+ */
+void energymon_shmem_write_end(energymon_shmem* ems);
+
+// table versions are distinguishable from energymon_shmem versions
+#define ENERGYMON_SHMEM_TABLE_VERSION 256
+
+/**
+ * An entry in a shared memory table.
+ */
+typedef struct energymon_shmem_table_entry {
+  // the energymon's source name
+  char source[64];
+  // uses the version 2 layout, regardless of ENERGYMON_SHMEM_VERSION
+  energymon_shmem shmem;
+} energymon_shmem_table_entry;
+
+/**
+ * The shared memory layout for providers that publish multiple energymons.
+ * All entries are sampled on the same timeline, i.e., samples in each round
+ * have the same timestamp.
+ * The header fields never change once version is set (providers set it last),
+ * so consumers must check version before using count.
+ * The version field has the same offset as in energymon_shmem, and the fields
+ * before it are always 0, so a table can't be mistaken for an energymon_shmem.
+ */
+typedef struct energymon_shmem_table {
+  volatile uint64_t reserved[4];
+  volatile uint64_t version;
+  volatile uint64_t count;
+  energymon_shmem_table_entry entries[];
+} energymon_shmem_table;
+
+/**
+ * Publish a new sample, including to the history ring.
+ * Must be called between energymon_shmem_write_begin and
+ * energymon_shmem_write_end.
+ */
+static inline void energymon_shmem_write_sample(energymon_shmem* ems, uint64_t time_ns,
+                                                uint64_t energy_uj) {
+  volatile energymon_sample* slot = &ems->ring[ems->n_samples % ENERGYMON_SHMEM_RING_LEN];
+  ems->energy_uj = energy_uj;
+  ems->time_ns = time_ns;
+  slot->time_ns = time_ns;
+  slot->energy_uj = energy_uj;
+  // the slot must be written before readers can see it
+  __atomic_store_n(&ems->n_samples, ems->n_samples + 1, __ATOMIC_RELEASE);
+}
+
+// readers spin this many times waiting for an update to finish before yielding the CPU
+#ifndef ENERGYMON_SHMEM_READ_SPIN_MAX
+#define ENERGYMON_SHMEM_READ_SPIN_MAX 1000
+#endif
+
+// then yield this many times before giving up
+#ifndef ENERGYMON_SHMEM_READ_YIELD_MAX
+#define ENERGYMON_SHMEM_READ_YIELD_MAX 100000
+#endif
+
+/**
+ * Begin reading a versioned shared memory segment.
+ * Waits until no update is in progress, but gives up if an update never
+ * finishes, e.g., if the provider was killed while writing.
+ *
+ * @param ems
+ * @param seq
+ *  set to the sequence value to pass to energymon_shmem_read_retry
+ * @return 0 on success, -1 if an update is stuck in progress (errno is set to
+ *         EAGAIN)
+ */
+static inline int energymon_shmem_read_begin(const energymon_shmem* ems, uint64_t* seq) {
+  unsigned long i;
+  for (i = 0; (*seq = __atomic_load_n(&ems->seq, __ATOMIC_ACQUIRE)) & 1; i++) {
+    // provider is writing
+    if (i >= ENERGYMON_SHMEM_READ_SPIN_MAX) {
+      if (i >= ENERGYMON_SHMEM_READ_SPIN_MAX + ENERGYMON_SHMEM_READ_YIELD_MAX) {
+        errno = EAGAIN;
+        return -1;
+      }
+      // the provider may have been preempted mid-update, let it run
+      sched_yield();
+    }
+  }
+  return 0;
+}
+
+/**
+ * Finish reading a versioned shared memory segment.
+ *
+ * @return non-zero if the values read may be inconsistent and must be re-read
+ */
+static inline int energymon_shmem_read_retry(const energymon_shmem* ems, uint64_t seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&ems->seq, __ATOMIC_RELAXED) != seq;
+}
+
 int energymon_init_shmem(energymon* em);
 
 uint64_t energymon_read_total_shmem(const energymon* em);
@@ -42,6 +194,56 @@ int energymon_is_exclusive_shmem(void);
 
 int energymon_get_shmem(energymon* em);
 
+size_t energymon_read_samples_shmem(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_shmem(energymon_ext* ext);
+
+/**
+ * Read the samples published since the cursor, oldest first.
+ * Requires a version 2 provider (sets errno to ENOTSUP otherwise).
+ *
+ * The cursor is the number of samples published when it was last updated;
+ * start with 0 to read all retained history.
+ * If n is 0, the cursor is set to the current sample count so subsequent calls
+ * only return new samples.
+ * Otherwise, the cursor is advanced past the samples read.
+ * If the consumer falls more than ENERGYMON_SHMEM_RING_LEN - 1 samples behind,
+ * the oldest samples are lost: the number lost is the cursor's increase minus
+ * the number of samples returned.
+ *
+ * @param em
+ * @param cursor
+ *  the consumer's cursor, must not be NULL
+ * @param samples
+ *  pointer to an array of at least n samples
+ * @param n
+ *  the maximum number of samples to read
+ * @return the number of samples read, or 0 on failure (errno is set) or if no
+ *         new samples are available (errno is 0)
+ */
+size_t energymon_read_history_shmem(const energymon* em, uint64_t* cursor,
+                                    energymon_sample* samples, size_t n);
+
+/**
+ * Block until the provider publishes a sample after the cursor, i.e., until
+ * more than cursor samples have been published.
+ * Requires a version 2 provider (sets errno to ENOTSUP otherwise) and Linux
+ * (sets errno to ENOSYS otherwise).
+ * The cursor isn't modified - use energymon_read_history_shmem or fread to get
+ * the new sample(s).
+ *
+ * Providers wake waiters in energymon_shmem_write_end.
+ *
+ * @param em
+ * @param cursor
+ *  the number of samples already seen
+ * @param timeout_us
+ *  the maximum time to wait in microseconds, or 0 to wait indefinitely
+ * @return 0 if a new sample is available, -1 on failure or timeout (errno is
+ *         set to ETIMEDOUT)
+ */
+int energymon_wait_shmem(const energymon* em, uint64_t cursor, uint64_t timeout_us);
+
 #ifdef __cplusplus
 }
 #endif
@@ -49,6 +49,9 @@ int main(void) {
   energymon em;
   energymon_shmem* ems;
   struct timespec ts;
+  struct timespec now;
+  uint64_t energy_uj;
+  uint64_t interval_us;
   const char* key_proj_id_env;
   const char* key_dir;
   int key_proj_id = ENERGYMON_SHMEM_ID_DEFAULT;
@@ -92,17 +95,24 @@ int main(void) {
     return -errno;
   }
   
-  // store the interval in shared memory
-  ems->interval_us = em.finterval(&em);
-  ts.tv_sec = (time_t) (ems->interval_us / (uint64_t) 1000000);
-  ts.tv_nsec = (long) ((ems->interval_us % (uint64_t) 1000000) * (uint64_t) 1000);
-
-  // store the precision in shared memory
+  // store the version, interval, and precision in shared memory
+  interval_us = em.finterval(&em);
+  ts.tv_sec = (time_t) (interval_us / (uint64_t) 1000000);
+  ts.tv_nsec = (long) ((interval_us % (uint64_t) 1000000) * (uint64_t) 1000);
+  energymon_shmem_write_begin(ems);
+  ems->version = ENERGYMON_SHMEM_VERSION;
+  ems->interval_us = interval_us;
   ems->precision_uj = em.fprecision(&em);
+  energymon_shmem_write_end(ems);
 
   while (running) {
     // update the energy in shared memory
-    ems->energy_uj = em.fread(&em);
+    energy_uj = em.fread(&em);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    energymon_shmem_write_begin(ems);
+    ems->heartbeat_ns = (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+    energymon_shmem_write_sample(ems, ems->heartbeat_ns, energy_uj);
+    energymon_shmem_write_end(ems);
     nanosleep(&ts, NULL);
   }
 
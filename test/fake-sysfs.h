@@ -0,0 +1,98 @@
+/**
+ * Helpers for tests that read from a fake sysfs tree in a temporary directory.
+ */
+#ifndef _FAKE_SYSFS_H_
+#define _FAKE_SYSFS_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int fake_failures = 0;
+
+// record (and report) a failure without stopping the test
+#define FAKE_CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      fake_failures++; \
+    } \
+  } while (0)
+
+/**
+ * Create a temporary directory for a tree, e.g., from a template like "/tmp/energymon-XXXXXX".
+ * Returns dir on success, NULL on failure.
+ */
+static inline char* fake_sysfs_create(char* dir) {
+  if (mkdtemp(dir) == NULL) {
+    perror(dir);
+    return NULL;
+  }
+  return dir;
+}
+
+static int fake_sysfs_remove_entry(const char* path, const struct stat* sb, int flag, struct FTW* ftwbuf) {
+  (void) sb;
+  (void) flag;
+  (void) ftwbuf;
+  return remove(path);
+}
+
+/**
+ * Remove a tree created with fake_sysfs_create.
+ */
+static inline void fake_sysfs_remove(const char* dir) {
+  if (nftw(dir, fake_sysfs_remove_entry, 16, FTW_DEPTH | FTW_PHYS)) {
+    perror(dir);
+  }
+}
+
+/**
+ * Write a file at dir/file, creating any missing parent directories.
+ * The file is overwritten in place (not replaced), so open file descriptors see the new contents.
+ * Returns 0 on success, -1 on failure.
+ */
+static inline int fake_sysfs_write(const char* dir, const char* file, const char* contents) {
+  char path[512];
+  char* p;
+  ssize_t len = (ssize_t) strlen(contents);
+  int fd;
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  for (p = strchr(path + strlen(dir) + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0755) && errno != EEXIST) {
+      perror(path);
+      return -1;
+    }
+    *p = '/';
+  }
+  if ((fd = open(path, O_WRONLY | O_CREAT, 0644)) < 0) {
+    perror(path);
+    return -1;
+  }
+  // a single write at offset 0, so readers never see an empty or partial value
+  if (pwrite(fd, contents, (size_t) len, 0) != len || ftruncate(fd, len)) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return close(fd);
+}
+
+/**
+ * Write an unsigned value, space-padded to a fixed width so that overwriting never leaves stale digits behind.
+ * (Not zero-padded - some readers use strtoull with base 0, which would parse a leading zero as octal.)
+ */
+static inline int fake_sysfs_write_u64(const char* dir, const char* file, uint64_t val) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%-20"PRIu64"\n", val);
+  return fake_sysfs_write(dir, file, buf);
+}
+
+#endif
@@ -6,6 +6,8 @@
 
 int main(void) {
   energymon em;
+  energymon_ext ext = { .size = sizeof(energymon_ext) };
+  energymon_sample samples[2];
   char source[100] = { '\0' };
   uint64_t result;
   uint64_t interval;
@@ -39,6 +41,18 @@ int main(void) {
   }
   printf("Got reading: %"PRIu64"\n", result);
 
+  if (energymon_get_ext(&ext)) {
+    return 1;
+  }
+  if (ext.fread_samples != NULL) {
+    if (ext.fread_samples(&em, samples, sizeof(samples) / sizeof(samples[0])) != sizeof(samples) / sizeof(samples[0])) {
+      perror("fread_samples");
+      return 1;
+    }
+    printf("Got samples: %"PRIu64" uJ @ %"PRIu64" ns, %"PRIu64" uJ @ %"PRIu64" ns\n",
+           samples[0].energy_uj, samples[0].time_ns, samples[1].energy_uj, samples[1].time_ns);
+  }
+
   if (em.ffinish(&em)) {
     perror("ffinish");
     return 1;
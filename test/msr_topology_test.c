@@ -0,0 +1,126 @@
+/**
+ * Test energymon-msr's CPU discovery against fake sysfs cpu topology trees, and its energy unit conversion.
+ * Includes the implementation directly since these are internal functions.
+ */
+#include "energymon-msr.c"
+#include "fake-sysfs.h"
+
+static int write_cpu(const char* root, unsigned int cpu, const char* pkg, const char* die) {
+  char file[64];
+  char buf[24];
+  snprintf(file, sizeof(file), "cpu%u/topology/physical_package_id", cpu);
+  snprintf(buf, sizeof(buf), "%s\n", pkg);
+  if (fake_sysfs_write(root, file, buf)) {
+    return -1;
+  }
+  if (die != NULL) {
+    snprintf(file, sizeof(file), "cpu%u/topology/die_id", cpu);
+    snprintf(buf, sizeof(buf), "%s\n", die);
+    return fake_sysfs_write(root, file, buf);
+  }
+  return 0;
+}
+
+static int check_cpus(const char* root, const char* expected) {
+  char* cpus = msr_discover_cpus(root);
+  int ret = cpus != NULL && !strcmp(cpus, expected);
+  if (cpus == NULL) {
+    perror("msr_discover_cpus");
+  } else if (!ret) {
+    fprintf(stderr, "msr_discover_cpus: expected %s, got %s\n", expected, cpus);
+  }
+  free(cpus);
+  return ret;
+}
+
+static int check_cpus_error(const char* root, int err) {
+  char* cpus;
+  errno = 0;
+  if ((cpus = msr_discover_cpus(root)) != NULL) {
+    fprintf(stderr, "msr_discover_cpus: expected an error, got %s\n", cpus);
+    free(cpus);
+    return 0;
+  }
+  return errno == err;
+}
+
+/**
+ * Two packages with two dies each, and an offline CPU that would otherwise be the first in its package/die.
+ */
+static void test_dies(const char* root) {
+  if (fake_sysfs_write(root, "online", "0-3,6\n") ||
+      write_cpu(root, 0, "0", "0") ||
+      write_cpu(root, 1, "0", "0") ||
+      write_cpu(root, 2, "0", "1") ||
+      write_cpu(root, 3, "1", "0") ||
+      write_cpu(root, 5, "1", "1") ||
+      write_cpu(root, 6, "1", "1")) {
+    fake_failures++;
+    return;
+  }
+  FAKE_CHECK(check_cpus(root, "0,2,3,6"));
+  // only the listed CPUs are considered
+  FAKE_CHECK(fake_sysfs_write(root, "online", "1,3-3\n") == 0);
+  FAKE_CHECK(check_cpus(root, "1,3"));
+  // malformed lists
+  FAKE_CHECK(fake_sysfs_write(root, "online", "3-1\n") == 0);
+  FAKE_CHECK(check_cpus_error(root, EINVAL));
+  FAKE_CHECK(fake_sysfs_write(root, "online", "0,x\n") == 0);
+  FAKE_CHECK(check_cpus_error(root, EINVAL));
+  FAKE_CHECK(fake_sysfs_write(root, "online", "\n") == 0);
+  FAKE_CHECK(check_cpus_error(root, ENODEV));
+}
+
+/**
+ * Kernels before Linux 5.2 have no die_id, and cpu0 may be offline.
+ */
+static void test_no_dies(const char* root) {
+  if (fake_sysfs_write(root, "online", "2-5\n") ||
+      write_cpu(root, 2, "0", NULL) ||
+      write_cpu(root, 3, "0", NULL) ||
+      write_cpu(root, 4, "1", NULL) ||
+      write_cpu(root, 5, "1", NULL)) {
+    fake_failures++;
+    return;
+  }
+  FAKE_CHECK(check_cpus(root, "2,4"));
+  // an unknown package can't be discovered
+  FAKE_CHECK(write_cpu(root, 5, "-1", NULL) == 0);
+  FAKE_CHECK(check_cpus_error(root, EINVAL));
+  // nor can a CPU without topology
+  FAKE_CHECK(fake_sysfs_write(root, "online", "2-6\n") == 0);
+  FAKE_CHECK(write_cpu(root, 5, "1", NULL) == 0);
+  FAKE_CHECK(check_cpus_error(root, ENOENT));
+}
+
+static void test_ticks_to_uj(void) {
+  FAKE_CHECK(msr_ticks_to_uj(0, 14) == 0);
+  FAKE_CHECK(msr_ticks_to_uj(1 << 14, 14) == 1000000);
+  FAKE_CHECK(msr_ticks_to_uj((3 << 16) | (1 << 15), 16) == 3500000);
+  // rounded down
+  FAKE_CHECK(msr_ticks_to_uj(1, 16) == 15);
+  // would overflow if all ticks were multiplied before shifting
+  FAKE_CHECK(msr_ticks_to_uj(((uint64_t) 1 << 50) + 1, 16) == UINT64_C(17179869184000015));
+}
+
+int main(void) {
+  char dies_root[] = "/tmp/energymon-msr-test-XXXXXX";
+  char no_dies_root[] = "/tmp/energymon-msr-test-XXXXXX";
+  if (fake_sysfs_create(dies_root) == NULL) {
+    return 1;
+  }
+  test_dies(dies_root);
+  fake_sysfs_remove(dies_root);
+  if (fake_sysfs_create(no_dies_root) == NULL) {
+    return 1;
+  }
+  test_no_dies(no_dies_root);
+  fake_sysfs_remove(no_dies_root);
+  test_ticks_to_uj();
+  if (fake_failures) {
+    fprintf(stderr, "%d check(s) failed\n", fake_failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
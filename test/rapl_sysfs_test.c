@@ -0,0 +1,235 @@
+/**
+ * Test energymon-rapl against fake powercap sysfs trees (see ENERGYMON_RAPL_ROOT).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "energymon.h"
+#include "energymon-rapl.h"
+#include "fake-sysfs.h"
+
+#define MAX_CHANNELS 8
+
+static int write_zone(const char* root, const char* zone, const char* name, uint64_t energy_uj,
+                      uint64_t max_energy_range_uj, uint64_t max_power_uw) {
+  char file[128];
+  char buf[80];
+  snprintf(file, sizeof(file), "%s/name", zone);
+  snprintf(buf, sizeof(buf), "%s\n", name);
+  if (fake_sysfs_write(root, file, buf)) {
+    return -1;
+  }
+  snprintf(file, sizeof(file), "%s/energy_uj", zone);
+  if (fake_sysfs_write_u64(root, file, energy_uj)) {
+    return -1;
+  }
+  snprintf(file, sizeof(file), "%s/max_energy_range_uj", zone);
+  if (fake_sysfs_write_u64(root, file, max_energy_range_uj)) {
+    return -1;
+  }
+  if (max_power_uw > 0) {
+    snprintf(file, sizeof(file), "%s/constraint_0_max_power_uw", zone);
+    return fake_sysfs_write_u64(root, file, max_power_uw);
+  }
+  return 0;
+}
+
+static int init_rapl(energymon* em, const char* root, const char* domains, const char* keepalive) {
+  setenv(ENERGYMON_RAPL_ROOT, root, 1);
+  if (domains == NULL) {
+    unsetenv(ENERGYMON_RAPL_DOMAINS);
+  } else {
+    setenv(ENERGYMON_RAPL_DOMAINS, domains, 1);
+  }
+  if (keepalive == NULL) {
+    unsetenv(ENERGYMON_RAPL_KEEPALIVE);
+  } else {
+    setenv(ENERGYMON_RAPL_KEEPALIVE, keepalive, 1);
+  }
+  energymon_get_rapl(em);
+  return em->finit(em);
+}
+
+static uint64_t read_total(const char* root, const char* domains) {
+  energymon em;
+  uint64_t uj;
+  if (init_rapl(&em, root, domains, NULL)) {
+    perror(domains);
+    fake_failures++;
+    return 0;
+  }
+  uj = em.fread(&em);
+  em.ffinish(&em);
+  return uj;
+}
+
+static const energymon_channel* find_channel(const energymon_channel* channels, size_t n, const char* name) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (!strcmp(channels[i].name, name)) {
+      return &channels[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Intel packages with core and dram subzones, psys, and duplicates of package zones from other control types.
+ */
+static void test_domains_and_channels(const char* root) {
+  energymon em;
+  energymon_ext ext = { .size = sizeof(energymon_ext) };
+  energymon_channel channels[MAX_CHANNELS];
+  const energymon_channel* c;
+  size_t n;
+  if (write_zone(root, "intel-rapl:0", "package-0", 1000, 100000, 0) ||
+      write_zone(root, "intel-rapl:0:0", "core", 200, 100000, 0) ||
+      write_zone(root, "intel-rapl:0:1", "dram", 300, 100000, 0) ||
+      write_zone(root, "intel-rapl:1", "package-1", 2000, 100000, 0) ||
+      write_zone(root, "intel-rapl:2", "psys", 5000, 100000, 0) ||
+      // duplicates must be ignored, so they have values that would be noticed in totals
+      write_zone(root, "intel-rapl-mmio:0", "package-0", 900000, 100000, 0) ||
+      write_zone(root, "amd-rapl:0", "package-1", 900000, 100000, 0)) {
+    fake_failures++;
+    return;
+  }
+
+  // domain selection
+  FAKE_CHECK(read_total(root, NULL) == 3000);
+  FAKE_CHECK(read_total(root, "package") == 3000);
+  FAKE_CHECK(read_total(root, "dram") == 300);
+  FAKE_CHECK(read_total(root, "core,dram") == 500);
+  FAKE_CHECK(read_total(root, "psys") == 5000);
+  errno = 0;
+  FAKE_CHECK(init_rapl(&em, root, "bogus", NULL) && errno == EINVAL);
+  errno = 0;
+  FAKE_CHECK(init_rapl(&em, root, "uncore", NULL) && errno == ENODEV);
+
+  // every zone is a channel, subzones are qualified by their parent, and duplicates are ignored
+  FAKE_CHECK(energymon_get_ext_rapl(&ext) == 0 && ext.fread_channels != NULL);
+  if (init_rapl(&em, root, NULL, NULL)) {
+    perror("init_rapl");
+    fake_failures++;
+    return;
+  }
+  n = ext.fread_channels(&em, NULL, 0);
+  FAKE_CHECK(n == 5);
+  if (n == 5) {
+    FAKE_CHECK(ext.fread_channels(&em, channels, n) == n);
+    FAKE_CHECK((c = find_channel(channels, n, "package-0")) != NULL && c->energy_uj == 1000);
+    FAKE_CHECK((c = find_channel(channels, n, "package-0:core")) != NULL && c->energy_uj == 200);
+    FAKE_CHECK((c = find_channel(channels, n, "package-0:dram")) != NULL && c->energy_uj == 300);
+    FAKE_CHECK((c = find_channel(channels, n, "package-1")) != NULL && c->energy_uj == 2000);
+    FAKE_CHECK((c = find_channel(channels, n, "psys")) != NULL && c->energy_uj == 5000);
+    errno = 0;
+    FAKE_CHECK(ext.fread_channels(&em, channels, n - 1) == 0 && errno == ENOBUFS);
+  }
+
+  // a counter that goes backwards overflowed at max_energy_range_uj
+  FAKE_CHECK(em.fread(&em) == 3000);
+  FAKE_CHECK(fake_sysfs_write_u64(root, "intel-rapl:0/energy_uj", 500) == 0);
+  FAKE_CHECK(em.fread(&em) == 500 + 100000 + 2000);
+  FAKE_CHECK(fake_sysfs_write_u64(root, "intel-rapl:0/energy_uj", 600) == 0);
+  FAKE_CHECK(em.fread(&em) == 600 + 100000 + 2000);
+  FAKE_CHECK(em.ffinish(&em) == 0);
+}
+
+/**
+ * AMD systems only have the amd-rapl control type.
+ */
+static void test_amd(const char* root) {
+  if (write_zone(root, "amd-rapl:0", "package-0", 1000, 100000, 0) ||
+      write_zone(root, "amd-rapl:0:0", "core", 200, 100000, 0)) {
+    fake_failures++;
+    return;
+  }
+  FAKE_CHECK(read_total(root, NULL) == 1000);
+  FAKE_CHECK(read_total(root, "core") == 200);
+}
+
+/**
+ * Wrap the counter twice between application reads, with enough time for keep-alive reads to see each value.
+ * Returns the energy reported after the second wrap.
+ */
+static uint64_t read_after_two_overflows(const char* root, const char* keepalive) {
+  energymon em;
+  uint64_t values[] = { 100, 2900, 50, 2500 };
+  uint64_t uj;
+  size_t i;
+  FAKE_CHECK(fake_sysfs_write_u64(root, "intel-rapl:0/energy_uj", 3000) == 0);
+  if (init_rapl(&em, root, NULL, keepalive)) {
+    perror("init_rapl");
+    fake_failures++;
+    return 0;
+  }
+  FAKE_CHECK(em.fread(&em) == 3000);
+  for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    FAKE_CHECK(fake_sysfs_write_u64(root, "intel-rapl:0/energy_uj", values[i]) == 0);
+    usleep(50000);
+  }
+  uj = em.fread(&em);
+  FAKE_CHECK(em.ffinish(&em) == 0);
+  return uj;
+}
+
+/**
+ * The computed keep-alive interval is a fraction of the time to overflow at the zone's max power.
+ */
+static void test_keepalive(const char* fast_root, const char* slow_root) {
+  // overflows in 4 ms at 1 W, so the computed interval is 1 ms
+  if (write_zone(fast_root, "intel-rapl:0", "package-0", 3000, 4000, 1000000) ||
+      // overflows in 4000 s at 1 uW
+      write_zone(slow_root, "intel-rapl:0", "package-0", 3000, 4000, 1)) {
+    fake_failures++;
+    return;
+  }
+  // without keep-alive, the application's reads only see one overflow
+  FAKE_CHECK(read_after_two_overflows(fast_root, NULL) == 2500 + 4000);
+  // the computed interval is short enough to see both
+  FAKE_CHECK(read_after_two_overflows(fast_root, "") == 2500 + 2 * 4000);
+  FAKE_CHECK(read_after_two_overflows(fast_root, "0") == 2500 + 2 * 4000);
+  // but not if the zone overflows slowly
+  FAKE_CHECK(read_after_two_overflows(slow_root, "") == 2500 + 4000);
+  // unless an interval is specified
+  FAKE_CHECK(read_after_two_overflows(slow_root, "1000") == 2500 + 2 * 4000);
+  energymon em;
+  errno = 0;
+  FAKE_CHECK(init_rapl(&em, slow_root, NULL, "bogus") && errno == EINVAL);
+}
+
+int main(void) {
+  char intel_root[] = "/tmp/energymon-rapl-test-XXXXXX";
+  char amd_root[] = "/tmp/energymon-rapl-test-XXXXXX";
+  char fast_root[] = "/tmp/energymon-rapl-test-XXXXXX";
+  char slow_root[] = "/tmp/energymon-rapl-test-XXXXXX";
+  if (fake_sysfs_create(intel_root) == NULL) {
+    return 1;
+  }
+  test_domains_and_channels(intel_root);
+  fake_sysfs_remove(intel_root);
+  if (fake_sysfs_create(amd_root) == NULL) {
+    return 1;
+  }
+  test_amd(amd_root);
+  fake_sysfs_remove(amd_root);
+  if (fake_sysfs_create(fast_root) == NULL) {
+    return 1;
+  }
+  if (fake_sysfs_create(slow_root) == NULL) {
+    fake_sysfs_remove(fast_root);
+    return 1;
+  }
+  test_keepalive(fast_root, slow_root);
+  fake_sysfs_remove(fast_root);
+  fake_sysfs_remove(slow_root);
+  if (fake_failures) {
+    fprintf(stderr, "%d check(s) failed\n", fake_failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * Test the hardware-independent internal utilities.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "energymon-integrate.h"
+#include "energymon-time-util.h"
+#include "energymon-util.h"
+#include "fake-sysfs.h"
+
+static int parse(const char* buf, uint64_t* val) {
+  errno = 0;
+  return energymon_parse_u64(buf, strlen(buf), val);
+}
+
+static void test_parse_u64(void) {
+  uint64_t val = 0;
+  FAKE_CHECK(parse("123\n", &val) == 0 && val == 123);
+  FAKE_CHECK(parse("0", &val) == 0 && val == 0);
+  FAKE_CHECK(parse("18446744073709551615", &val) == 0 && val == UINT64_MAX);
+  FAKE_CHECK(parse("18446744073709551616", &val) && errno == ERANGE);
+  FAKE_CHECK(parse("", &val) && errno == EINVAL);
+  FAKE_CHECK(parse("abc", &val) && errno == EINVAL);
+  FAKE_CHECK(parse("-1", &val) && errno == EINVAL);
+  // buffers from pread aren't NUL-terminated
+  FAKE_CHECK(energymon_parse_u64("12345", 3, &val) == 0 && val == 123);
+}
+
+static void test_integration_parse(void) {
+  energymon_integration rule;
+  FAKE_CHECK(energymon_integration_parse(NULL, &rule) == 0 && rule == ENERGYMON_INTEGRATION_RECTANGLE);
+  FAKE_CHECK(energymon_integration_parse("rectangle", &rule) == 0 && rule == ENERGYMON_INTEGRATION_RECTANGLE);
+  FAKE_CHECK(energymon_integration_parse("trapezoid", &rule) == 0 && rule == ENERGYMON_INTEGRATION_TRAPEZOID);
+  FAKE_CHECK(energymon_integration_parse("window", &rule) == 0 && rule == ENERGYMON_INTEGRATION_WINDOW);
+  errno = 0;
+  FAKE_CHECK(energymon_integration_parse("simpson", &rule) && errno == EINVAL);
+}
+
+static void test_integrator(void) {
+  energymon_integrator integ;
+  // 1 W for 1 ms, then 3 W after another 1 ms
+  energymon_integrator_init(&integ, ENERGYMON_INTEGRATION_RECTANGLE, 0);
+  FAKE_CHECK(energymon_integrator_add(&integ, 1000000, 1000) == 1000);
+  FAKE_CHECK(energymon_integrator_add(&integ, 3000000, 1000) == 3000);
+  // without a previous sample, every rule uses the first sample for the whole interval
+  energymon_integrator_init(&integ, ENERGYMON_INTEGRATION_TRAPEZOID, 0);
+  FAKE_CHECK(energymon_integrator_add(&integ, 1000000, 1000) == 1000);
+  FAKE_CHECK(energymon_integrator_add(&integ, 3000000, 1000) == 2000);
+  // the 0.5 ms window is at 3 W, the rest of the interval is interpolated at 2 W
+  energymon_integrator_init(&integ, ENERGYMON_INTEGRATION_WINDOW, 500);
+  FAKE_CHECK(energymon_integrator_add(&integ, 1000000, 1000) == 1000);
+  FAKE_CHECK(energymon_integrator_add(&integ, 3000000, 1000) == 2500);
+  // a window that covers the whole interval is the same as a rectangle
+  energymon_integrator_init(&integ, ENERGYMON_INTEGRATION_WINDOW, 2000);
+  FAKE_CHECK(energymon_integrator_add(&integ, 1000000, 1000) == 1000);
+  FAKE_CHECK(energymon_integrator_add(&integ, 3000000, 1000) == 3000);
+  // fractional microjoules carry over to later samples
+  energymon_integrator_init(&integ, ENERGYMON_INTEGRATION_RECTANGLE, 0);
+  FAKE_CHECK(energymon_integrator_add(&integ, 500000, 1) == 0);
+  FAKE_CHECK(energymon_integrator_add(&integ, 500000, 1) == 1);
+}
+
+static void test_periodic_advance(void) {
+  energymon_periodic p = { .interval_ns = 10, .deadline_ns = 100, .overruns = 0 };
+  FAKE_CHECK(energymon_periodic_advance(&p, 95) == 0 && p.deadline_ns == 100);
+  FAKE_CHECK(energymon_periodic_advance(&p, 100) == 1 && p.deadline_ns == 110);
+  // skipped deadlines keep the original phase
+  FAKE_CHECK(energymon_periodic_advance(&p, 135) == 3 && p.deadline_ns == 140);
+  FAKE_CHECK(p.overruns == 0);
+}
+
+int main(void) {
+  test_parse_u64();
+  test_integration_parse();
+  test_integrator();
+  test_periodic_advance();
+  if (fake_failures) {
+    fprintf(stderr, "%d check(s) failed\n", fake_failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
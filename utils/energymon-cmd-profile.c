@@ -36,14 +36,29 @@ static void print_usage(int exit_code) {
   exit(exit_code);
 }
 
+/**
+ * Read a sample with fread_samples, if supported, otherwise timestamp a regular read.
+ */
+static size_t read_sample(const energymon* em, const energymon_ext* ext, energymon_sample* sample) {
+  if (ext->fread_samples != NULL) {
+    return ext->fread_samples(em, sample, 1);
+  }
+  sample->time_ns = energymon_gettime_ns();
+  errno = 0;
+  sample->energy_uj = em->fread(em);
+  return sample->energy_uj == 0 && errno ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
   char cmd[CMD_MAX_LEN] = { 0 };
   energymon em;
+  energymon_ext ext;
+  energymon_sample sample_start;
+  energymon_sample sample_end;
   uint64_t time_start_ns;
   uint64_t time_end_ns;
   uint64_t time_total_ns;
-  uint64_t energy_start_uj;
-  uint64_t energy_end_uj;
+  uint64_t sample_total_ns;
   uint64_t energy_total_uj;
   double watts;
   int cmd_ret;
@@ -88,12 +103,16 @@ int main(int argc, char** argv) {
     perror("energymon:finit");
     exit(1);
   }
+  // samples are timestamped by the implementation, e.g., when it polled its sensors, not when we read them
+  ext.size = sizeof(ext);
+  if (energymon_get_ext(&ext)) {
+    em.ffinish(&em);
+    exit(1);
+  }
 
   // get start time/energy
-  errno = 0;
-  energy_start_uj = em.fread(&em);
-  if (!energy_start_uj && errno) {
-    perror("energymon:fread");
+  if (read_sample(&em, &ext, &sample_start) != 1) {
+    perror("energymon:fread_samples");
     em.ffinish(&em);
     exit(1);
   }
@@ -104,10 +123,8 @@ int main(int argc, char** argv) {
   cmd_ret = system(cmd);
   
   // get end time/energy
-  errno = 0;
-  energy_end_uj = em.fread(&em);
-  if (!energy_end_uj && errno) {
-    perror("energymon:fread");
+  if (read_sample(&em, &ext, &sample_end) != 1) {
+    perror("energymon:fread_samples");
     em.ffinish(&em);
     exit(1);
   }
@@ -119,8 +136,10 @@ int main(int argc, char** argv) {
   }
 
   time_total_ns = time_end_ns - time_start_ns;
-  energy_total_uj = energy_end_uj - energy_start_uj;
-  watts = time_total_ns > 0 ? (energy_total_uj * 1000.0 / time_total_ns) : 0;
+  energy_total_uj = sample_end.energy_uj - sample_start.energy_uj;
+  // power is over the interval between the samples, which may differ from the command's execution time
+  sample_total_ns = sample_end.time_ns - sample_start.time_ns;
+  watts = sample_total_ns > 0 ? (energy_total_uj * 1000.0 / sample_total_ns) : 0;
   printf("Time (ns): %"PRIu64"\n", time_total_ns);
   printf("Energy (uJ): %"PRIu64"\n", energy_total_uj);
   printf("Power (W): %f\n", watts);
@@ -28,7 +28,8 @@ static void print_usage(int exit_code) {
           "Usage: "ENERGYMON_UTIL_PREFIX"-info [OPTION]...\n\n"
           "Prints information from the EnergyMon interface functions, including source\n"
           "name, exclusivity, refresh interval, energy reading precision, and a current\n"
-          "energy value.\n\n"
+          "energy value.\n"
+          "If supported, also prints the current energy value of each channel.\n\n"
           "Even if the EnergyMon implementation fails to initialize, the program will\n"
           "attempt to read from as many functions as possible.\n\n"
           "Options:\n"
@@ -39,6 +40,10 @@ static void print_usage(int exit_code) {
 int main(int argc, char** argv) {
   char buf[256] = { 0 };
   energymon em;
+  energymon_ext ext = { .size = sizeof(energymon_ext) };
+  energymon_channel* channels = NULL;
+  size_t n_channels = 0;
+  size_t i;
   uint64_t reading = 0;
   int ret;
   int c;
@@ -70,6 +75,16 @@ int main(int argc, char** argv) {
     if (!reading && errno) {
       perror("energymon:fread");
     }
+    if (!energymon_get_ext(&ext) && ext.fread_channels != NULL &&
+        (n_channels = ext.fread_channels(&em, NULL, 0)) > 0) {
+      if ((channels = malloc(n_channels * sizeof(energymon_channel))) == NULL) {
+        perror("malloc");
+        n_channels = 0;
+      } else if (ext.fread_channels(&em, channels, n_channels) == 0) {
+        perror("energymon:fread_channels");
+        n_channels = 0;
+      }
+    }
   }
 
   printf("source: %s\n", buf);
@@ -77,6 +92,10 @@ int main(int argc, char** argv) {
   printf("interval (usec): %"PRIu64"\n", em.finterval(&em));
   printf("precision (uJ): %"PRIu64"\n", em.fprecision(&em));
   printf("reading (uJ): %"PRIu64 "\n", reading);
+  for (i = 0; i < n_channels; i++) {
+    printf("channel %s (uJ): %"PRIu64"\n", channels[i].name, channels[i].energy_uj);
+  }
+  free(channels);
   
   // cleanup
   if (!ret && em.ffinish(&em)) {
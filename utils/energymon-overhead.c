@@ -30,7 +30,10 @@ static void print_usage(int exit_code) {
   fprintf(exit_code ? stderr : stdout,
           "Usage: "ENERGYMON_UTIL_PREFIX"-overhead [OPTION]...\n\n"
           "Measure the overhead of the init, read, and finish functions. Results are in\n"
-          "nanoseconds.\n\n"
+          "nanoseconds.\n"
+          "If supported, also measures the overhead of reading all channels.\n"
+          "Init is measured a second time since implementations may cache discovery\n"
+          "results, so later instances in a process can be cheaper.\n\n"
           "Note that overhead readings can only be as precise as the system clock supports.\n\n"
           "Options:\n"
           "  -h, --help               Print this message and exit\n");
@@ -40,8 +43,12 @@ static void print_usage(int exit_code) {
 int main(int argc, char** argv) {
   char source[64] = { 0 };
   static energymon em;
+  energymon_ext ext = { .size = sizeof(energymon_ext) };
+  energymon_channel* channels = NULL;
+  size_t n_channels = 0;
   uint64_t time_start_ns, time_end_ns;
-  uint64_t finit_ns, fread_ns, ffinish_ns;
+  uint64_t finit_ns, fread_ns, ffinish_ns, finit_again_ns;
+  uint64_t fread_channels_ns = 0;
   uint64_t energy_uj;
   int ret;
   int c;
@@ -73,7 +80,7 @@ int main(int argc, char** argv) {
   time_end_ns = energymon_gettime_ns();
   finit_ns = time_end_ns - time_start_ns;
   if (ret) {
-    perror("energmon:finit");
+    perror("energymon:finit");
     exit(1);
   }
 
@@ -89,18 +96,56 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
+  // read channels - allocate first so we only profile the read
+  if (!energymon_get_ext(&ext) && ext.fread_channels != NULL &&
+      (n_channels = ext.fread_channels(&em, NULL, 0)) > 0) {
+    if ((channels = malloc(n_channels * sizeof(energymon_channel))) == NULL) {
+      perror("malloc");
+      em.ffinish(&em);
+      exit(1);
+    }
+    time_start_ns = energymon_gettime_ns();
+    ret = ext.fread_channels(&em, channels, n_channels) == 0;
+    time_end_ns = energymon_gettime_ns();
+    fread_channels_ns = time_end_ns - time_start_ns;
+    free(channels);
+    if (ret) {
+      perror("energymon:fread_channels");
+      em.ffinish(&em);
+      exit(1);
+    }
+  }
+
   // finish
   time_start_ns = energymon_gettime_ns();
   ret = em.ffinish(&em);
   time_end_ns = energymon_gettime_ns();
   ffinish_ns = time_end_ns - time_start_ns;
   if (ret) {
-    perror("energmon:ffinish");
+    perror("energymon:ffinish");
+    exit(1);
+  }
+
+  // init again
+  time_start_ns = energymon_gettime_ns();
+  ret = em.finit(&em);
+  time_end_ns = energymon_gettime_ns();
+  finit_again_ns = time_end_ns - time_start_ns;
+  if (ret) {
+    perror("energymon:finit");
+    exit(1);
+  }
+  if (em.ffinish(&em)) {
+    perror("energymon:ffinish");
     exit(1);
   }
 
   fprintf(stdout, "%s\nfinit: %"PRIu64"\nfread: %"PRIu64"\nffinish: %"PRIu64"\n",
                   source, finit_ns, fread_ns, ffinish_ns);
+  if (n_channels > 0) {
+    fprintf(stdout, "fread_channels (%zu channels): %"PRIu64"\n", n_channels, fread_channels_ns);
+  }
+  fprintf(stdout, "finit (again): %"PRIu64"\n", finit_again_ns);
 
   return 0;
 }
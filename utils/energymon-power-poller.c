@@ -106,6 +106,19 @@ static void parse_args(int argc, char** argv) {
   }
 }
 
+/**
+ * Read a sample with fread_samples, if supported, otherwise timestamp a regular read.
+ */
+static size_t read_sample(const energymon* em, const energymon_ext* ext, energymon_sample* sample) {
+  if (ext->fread_samples != NULL) {
+    return ext->fread_samples(em, sample, 1);
+  }
+  sample->time_ns = energymon_gettime_ns();
+  errno = 0;
+  sample->energy_uj = em->fread(em);
+  return sample->energy_uj == 0 && errno ? 0 : 1;
+}
+
 static void shandle(int sig) {
   switch (sig) {
     case SIGTERM:
@@ -127,12 +140,12 @@ static void shandle(int sig) {
 
 int main(int argc, char** argv) {
   energymon em;
+  energymon_ext ext;
+  energymon_sample sample;
   uint64_t min_interval;
-  uint64_t energy;
   uint64_t energy_last;
-  uint64_t last_us;
-  uint64_t exec_us;
-  float power;
+  uint64_t last_ns;
+  float power = 0;
   uint64_t n = 0;
   float pmin = FLT_MAX;
   float pmax = FLT_MIN;
@@ -155,6 +168,12 @@ int main(int argc, char** argv) {
     perror("energymon:finit");
     return 1;
   }
+  // samples are timestamped by the implementation, e.g., when it polled its sensors, not when we read them
+  ext.size = sizeof(ext);
+  if (energymon_get_ext(&ext)) {
+    em.ffinish(&em);
+    return 1;
+  }
 
   // get the update interval
   min_interval = em.finterval(&em);
@@ -180,16 +199,31 @@ int main(int argc, char** argv) {
   }
 
   // output at regular intervals
-  energy_last = em.fread(&em);
-  last_us = energymon_gettime_us();
+  if (read_sample(&em, &ext, &sample) != 1) {
+    perror("energymon:fread_samples");
+    if (filename != NULL) {
+      fclose(fout);
+    }
+    em.ffinish(&em);
+    return 1;
+  }
+  energy_last = sample.energy_uj;
+  last_ns = sample.time_ns;
   energymon_sleep_us(interval, &IGNORE_INTERRUPT);
   while (running) {
     if (count) {
       running--;
     }
-    energy = em.fread(&em);
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    power = (energy - energy_last) / ((float) exec_us);
+    if (read_sample(&em, &ext, &sample) != 1) {
+      perror("energymon:fread_samples");
+      ret = 1;
+      break;
+    }
+    // if the underlying sample hasn't changed, report the previous power
+    if (sample.time_ns > last_ns) {
+      power = (sample.energy_uj - energy_last) * 1000 / ((float) (sample.time_ns - last_ns));
+    }
+    last_ns = sample.time_ns;
     if (fprintf(fout, "%f\n", power) < 0) {
       ret = 1;
       if (filename == NULL) {
@@ -201,7 +235,7 @@ int main(int argc, char** argv) {
       break;
     }
     fflush(fout);
-    energy_last = energy;
+    energy_last = sample.energy_uj;
     if (power > pmax) {
       pmax = power;
     }
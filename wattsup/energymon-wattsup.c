@@ -15,6 +15,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "energymon.h"
+#include "energymon-ext.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #include "energymon-wattsup.h"
 #include "wattsup-driver.h"
@@ -24,6 +26,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_wattsup(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_wattsup(ext);
+}
 #endif
 
 // Environment variable to enable updating energy estimates b/w device reads.
@@ -52,44 +57,29 @@ typedef struct energymon_wattsup {
   pthread_t thread;
   int use_estimates;
 
-  uint64_t exec_us;
+  // only accessed by the polling thread
   uint64_t last_us;
   unsigned int deciwatts;
-  int lock;
   uint64_t total_uj;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // the highest estimate returned to readers, so estimates never decrease
+  uint64_t extrapolated_uj;
 } energymon_wattsup;
 
-static void lock_acquire(int* lock) {
-  assert(lock != NULL);
-#if defined(_WIN32)
-  while (InterlockedExchange((long*) lock, 1)) {
-#else
-  while (__sync_lock_test_and_set(lock, 1)) {
-#endif
-    while (*lock);
-  }
-}
-
-static void lock_release(int* lock) {
-#if defined(_WIN32)
-  InterlockedExchange((long*) lock, 0);
-#else
-  __sync_lock_release(lock);
-#endif
-}
-
 // Only for use by the polling thread - enables pthread cancel while sleeping, then disables it
-static int wattsup_thread_sleep_us(uint64_t us, volatile const int* poll) {
+// Sleeps until the period's next deadline, or for us microseconds if period is NULL
+static int wattsup_thread_sleep(energymon_periodic* period, uint64_t us, volatile const int* poll) {
   assert(poll != NULL);
   int ret = 0;
   if (*poll) {
 #ifndef __ANDROID__
     // Deadlock can occur during disconnect in some wattsup_driver impls if thread is canceled during I/O
-    // Enable thread cancel while sleeping, disable during I/O and when holding locks
+    // Enable thread cancel while sleeping, disable during I/O and when publishing samples
     int dummy_old_state;
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &dummy_old_state);
 #endif
-    ret = energymon_sleep_us(us, poll);
+    ret = period == NULL ? energymon_sleep_us(us, poll) : energymon_periodic_wait(period, poll);
 #ifndef __ANDROID__
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &dummy_old_state);
 #endif
@@ -172,7 +162,7 @@ static char* data_packet_read(energymon_wattsup_ctx* ctx, char* buf, size_t bufs
       return NULL;
     }
     // short wait before reading again to try and get the rest of the packet
-    wattsup_thread_sleep_us(WU_PACKET_WAIT_INTERVAL_US, poll);
+    wattsup_thread_sleep(NULL, WU_PACKET_WAIT_INTERVAL_US, poll);
     if (!(*poll)) {
       // we were probably ordered to stop during I/O or sleep
       return NULL;
@@ -202,26 +192,29 @@ static void* wattsup_poll_sensors(void* args) {
   energymon_wattsup* state = (energymon_wattsup*) args;
   char buf[WU_BUFSIZE] = { 0 };
   char* pstart;
+  energymon_periodic period;
+  unsigned int deciwatts = 0;
+  uint64_t exec_us;
   state->deciwatts = 0;
   if (!(state->last_us = energymon_gettime_us())) {
     // must be that CLOCK_MONOTONIC is not supported
     perror("wattsup_poll_sensors");
     return (void*) NULL;
   }
-  wattsup_thread_sleep_us(WU_POLL_INTERVAL_US, &state->poll);
+  energymon_published_store(&state->pub, 0, state->last_us * 1000, 0);
+  energymon_periodic_init(&period, WU_POLL_INTERVAL_US);
+  wattsup_thread_sleep(&period, 0, &state->poll);
   while (state->poll) {
     if ((pstart = data_packet_read(state->ctx, buf, sizeof(buf), &state->poll))) {
-      data_packet_parse(pstart, &state->deciwatts);
+      data_packet_parse(pstart, &deciwatts);
     }
-    if (state->use_estimates) {
-      lock_acquire(&state->lock);
-    }
-    state->exec_us = energymon_gettime_elapsed_us(&state->last_us);
-    state->total_uj += state->deciwatts * state->exec_us / 10;
-    if (state->use_estimates) {
-      lock_release(&state->lock);
-    }
-    wattsup_thread_sleep_us(WU_POLL_INTERVAL_US, &state->poll);
+    exec_us = energymon_gettime_elapsed_us(&state->last_us);
+    // the power is the average since the last successful read
+    state->total_uj += deciwatts * exec_us / 10;
+    state->deciwatts = deciwatts;
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000,
+                              (uint64_t) state->deciwatts * 100000);
+    wattsup_thread_sleep(&period, 0, &state->poll);
   }
   return (void*) NULL;
 }
@@ -363,12 +356,18 @@ uint64_t energymon_read_total_wattsup(const energymon* em) {
   energymon_wattsup* state = (energymon_wattsup*) em->state;
   errno = 0;
   if (state->use_estimates) {
-    lock_acquire(&state->lock);
-    state->exec_us = energymon_gettime_elapsed_us(&state->last_us);
-    state->total_uj += state->deciwatts * state->exec_us / 10;
-    lock_release(&state->lock);
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(), 0);
+  }
+  return energymon_published_energy(&state->pub);
+}
+
+size_t energymon_read_samples_wattsup(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
   }
-  return state->total_uj;
+  energymon_wattsup* state = (energymon_wattsup*) em->state;
+  return energymon_published_read_samples(&state->pub, state->use_estimates, &state->extrapolated_uj, 0, samples, n);
 }
 
 char* energymon_get_source_wattsup(char* buffer, size_t n) {
@@ -412,3 +411,7 @@ int energymon_get_wattsup(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_wattsup(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_wattsup);
+}
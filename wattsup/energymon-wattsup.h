@@ -37,6 +37,10 @@ int energymon_is_exclusive_wattsup(void);
 
 int energymon_get_wattsup(energymon* em);
 
+size_t energymon_read_samples_wattsup(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_wattsup(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif
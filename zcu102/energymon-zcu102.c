@@ -9,13 +9,16 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "energymon.h"
+#include "energymon-ext.h"
 #include "energymon-zcu102.h"
+#include "energymon-integrate.h"
+#include "energymon-poller.h"
+#include "energymon-published.h"
 #include "energymon-time-util.h"
 #include "energymon-util.h"
 
@@ -24,6 +27,9 @@
 int energymon_get_default(energymon* em) {
   return energymon_get_zcu102(em);
 }
+int energymon_get_ext_default(energymon_ext* ext) {
+  return energymon_get_ext_zcu102(ext);
+}
 #endif
 
 #define INA226_DIR "/sys/class/hwmon"
@@ -39,11 +45,20 @@ int energymon_get_default(energymon* em) {
 typedef struct energymon_zcu102 {
   // sensor update interval in microseconds
   unsigned long read_delay_us;
-  // thread variables
-  pthread_t thread;
-  int poll_sensors;
-  // total energy estimate
+  // shared polling thread registration
+  energymon_poller_task task;
+  int polling;
+  uint64_t last_us;
+  // total energy estimate, only accessed by the polling thread
   uint64_t total_uj;
+  energymon_integrator integ;
+  // adapts the polling interval to the power signal
+  energymon_poller_adaptive adapt;
+  // the most recent sample, for readers
+  energymon_published pub;
+  // extrapolate reads from the most recent sample, never returning less than extrapolated_uj
+  int extrapolate;
+  uint64_t extrapolated_uj;
   // sensor file descriptors
   unsigned int count;
   int fds[];
@@ -105,13 +120,11 @@ int energymon_finish_zcu102(energymon* em) {
   unsigned int i;
   energymon_zcu102* state = (energymon_zcu102*) em->state;
 
-  if (state->poll_sensors) {
-    // stop sensors polling thread and cleanup
-    state->poll_sensors = 0;
-#ifndef __ANDROID__
-    pthread_cancel(state->thread);
-#endif
-    err_save = pthread_join(state->thread, NULL);
+  if (state->polling) {
+    // stop polling the sensors and cleanup
+    if (energymon_poller_unregister(&state->task)) {
+      err_save = errno;
+    }
   }
 
   // close individual sensor files
@@ -172,52 +185,37 @@ static inline char** get_sensor_directories(unsigned int* count) {
 }
 
 /**
- * pthread function to poll the sensors at regular intervals.
+ * Poller function to read the sensors at regular intervals.
  */
-static void* zcu102_poll_sensors(void* args) {
+static void zcu102_poll_sensors(void* args) {
   energymon_zcu102* state = (energymon_zcu102*) args;
   char cdata[10];
-  double sum_w;
   unsigned long sum_uw;
   unsigned int i;
   uint64_t exec_us;
-  uint64_t last_us;
   uint64_t delta_uj;
   int err_save;
-  if (!(last_us = energymon_gettime_us())) {
-    // must be that CLOCK_MONOTONIC is not supported
-    perror("zcu102_poll_sensors");
-    return (void*) NULL;
-  }
-  energymon_sleep_us(state->read_delay_us, &state->poll_sensors);
-  while (state->poll_sensors) {
-    // read individual sensors (values in microWatts)
-    for (sum_uw = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
-      if (pread(state->fds[i], cdata, sizeof(cdata), 0) > 0) {
-        sum_uw += strtoul(cdata, NULL, 0);
-      }
+  // read individual sensors (values in microWatts)
+  for (sum_uw = 0, errno = 0, i = 0; i < state->count && !errno; i++) {
+    if (pread(state->fds[i], cdata, sizeof(cdata), 0) > 0) {
+      sum_uw += strtoul(cdata, NULL, 0);
     }
-    err_save = errno;
-    exec_us = energymon_gettime_elapsed_us(&last_us);
-    if (err_save) {
-      errno = err_save;
-      perror("zcu102_poll_sensors: skipping power sensor reading");
-    } else {
-      sum_w = sum_uw / 1e6;
-      delta_uj = (uint64_t) (sum_w * (double) exec_us);
+  }
+  err_save = errno;
+  exec_us = energymon_gettime_elapsed_us(&state->last_us);
+  if (err_save) {
+    errno = err_save;
+    perror("zcu102_poll_sensors: skipping power sensor reading");
+  } else {
+    delta_uj = energymon_integrator_add(&state->integ, (double) sum_uw, exec_us);
 #ifdef ENERGYMON_DEBUG
-      fprintf(stderr, "zcu102_poll_sensors: Read total power: %lu uW (%f W)\n", sum_uw, sum_w);
-      fprintf(stderr, "zcu102_poll_sensors: Calculated energy: %f W * %"PRIi64" us = %"PRIu64" uJ\n", sum_w, exec_us, delta_uj);
+    fprintf(stderr, "zcu102_poll_sensors: Read total power: %lu uW (%f W)\n", sum_uw, sum_uw / 1e6);
+    fprintf(stderr, "zcu102_poll_sensors: Calculated energy: %f W * %"PRIu64" us = %"PRIu64" uJ\n", sum_uw / 1e6, exec_us, delta_uj);
 #endif
-      state->total_uj += delta_uj;
-    }
-    // sleep for the update interval of the sensors
-    if (state->poll_sensors) {
-      energymon_sleep_us(state->read_delay_us, &state->poll_sensors);
-    }
-    errno = 0;
+    state->total_uj += delta_uj;
+    energymon_published_store(&state->pub, state->total_uj, state->last_us * 1000, sum_uw);
+    energymon_poller_set_interval(&state->task, energymon_poller_adaptive_next(&state->adapt, (double) sum_uw));
   }
-  return (void*) NULL;
 }
 
 /**
@@ -229,6 +227,13 @@ int energymon_init_zcu102(energymon* em) {
     return -1;
   }
 
+  energymon_integration rule;
+  const char* rule_str = getenv(ENERGYMON_ZCU102_INTEGRATION);
+  if (energymon_integration_parse(rule_str, &rule)) {
+    fprintf(stderr, "energymon_init_zcu102: unknown integration rule: "ENERGYMON_ZCU102_INTEGRATION"=%s\n", rule_str);
+    return -1;
+  }
+
   unsigned int i;
   char file[64];
   unsigned int count;
@@ -273,16 +278,29 @@ int energymon_init_zcu102(energymon* em) {
   // we're finished with this variable
   free_sensor_directories(sensor_dirs, state->count);
 
-  // start sensors polling thread
-  state->poll_sensors = 1;
-  errno = pthread_create(&state->thread, NULL, zcu102_poll_sensors, state);
-  if (errno) {
+  state->extrapolate = getenv(ENERGYMON_ZCU102_EXTRAPOLATE) != NULL;
+  energymon_integrator_init(&state->integ, rule, state->read_delay_us);
+
+  if (energymon_poller_adaptive_init(&state->adapt, state->read_delay_us,
+                                     ENERGYMON_ZCU102_INTERVAL_MIN_US, ENERGYMON_ZCU102_INTERVAL_MAX_US)) {
     err_save = errno;
+    fprintf(stderr, "energymon_init_zcu102: invalid polling interval bounds: "
+            ENERGYMON_ZCU102_INTERVAL_MIN_US", "ENERGYMON_ZCU102_INTERVAL_MAX_US"\n");
     energymon_finish_zcu102(em);
     errno = err_save;
     return -1;
   }
 
+  // start polling the sensors
+  if (!(state->last_us = energymon_gettime_us()) ||
+      energymon_poller_register(&state->task, state->adapt.min_us, zcu102_poll_sensors, state)) {
+    err_save = errno;
+    energymon_finish_zcu102(em);
+    errno = err_save;
+    return -1;
+  }
+  state->polling = 1;
+
   return 0;
 }
 
@@ -291,8 +309,23 @@ uint64_t energymon_read_total_zcu102(const energymon* em) {
     errno = EINVAL;
     return 0;
   }
+  energymon_zcu102* state = (energymon_zcu102*) em->state;
   errno = 0;
-  return ((energymon_zcu102*) em->state)->total_uj;
+  if (state->extrapolate) {
+    return energymon_published_extrapolate(&state->pub, &state->extrapolated_uj, energymon_gettime_ns(),
+                                           state->adapt.max_us * 1000);
+  }
+  return energymon_published_energy(&state->pub);
+}
+
+size_t energymon_read_samples_zcu102(const energymon* em, energymon_sample* samples, size_t n) {
+  if (em == NULL || em->state == NULL || (samples == NULL && n > 0)) {
+    errno = EINVAL;
+    return 0;
+  }
+  energymon_zcu102* state = (energymon_zcu102*) em->state;
+  return energymon_published_read_samples(&state->pub, state->extrapolate, &state->extrapolated_uj,
+                                          state->adapt.max_us * 1000, samples, n);
 }
 
 char* energymon_get_source_zcu102(char* buffer, size_t n) {
@@ -337,3 +370,7 @@ int energymon_get_zcu102(energymon* em) {
   em->state = NULL;
   return 0;
 }
+
+int energymon_get_ext_zcu102(energymon_ext* ext) {
+  return energymon_get_ext_fallback_samples(ext, &energymon_read_samples_zcu102);
+}
@@ -15,6 +15,29 @@ extern "C" {
 #include <stddef.h>
 #include "energymon.h"
 
+/*
+ * Environment variable to extrapolate energy between samples using the most recent power reading.
+ */
+#define ENERGYMON_ZCU102_EXTRAPOLATE "ENERGYMON_ZCU102_EXTRAPOLATE"
+
+/*
+ * Environment variable to select the rule for integrating power samples into energy:
+ * "rectangle" (default), "trapezoid", or "window" (the sensor's averaging window).
+ */
+#define ENERGYMON_ZCU102_INTEGRATION "ENERGYMON_ZCU102_INTEGRATION"
+
+/*
+ * Environment variable to enable adaptive polling: while the power is flat, the polling interval backs off up to this
+ * many microseconds, and returns to the minimum when the power changes.
+ */
+#define ENERGYMON_ZCU102_INTERVAL_MAX_US "ENERGYMON_ZCU102_INTERVAL_MAX_US"
+
+/*
+ * Environment variable to override the minimum adaptive polling interval in microseconds (defaults to the sensor update
+ * interval).
+ */
+#define ENERGYMON_ZCU102_INTERVAL_MIN_US "ENERGYMON_ZCU102_INTERVAL_MIN_US"
+
 int energymon_init_zcu102(energymon* em);
 
 uint64_t energymon_read_total_zcu102(const energymon* em);
@@ -31,6 +54,10 @@ int energymon_is_exclusive_zcu102(void);
 
 int energymon_get_zcu102(energymon* em);
 
+size_t energymon_read_samples_zcu102(const energymon* em, energymon_sample* samples, size_t n);
+
+int energymon_get_ext_zcu102(energymon_ext* ext);
+
 #ifdef __cplusplus
 }
 #endif